@@ -0,0 +1,18 @@
+find_path(ZSTD_INCLUDE_DIR
+    NAMES zstd.h
+)
+
+find_library(ZSTD_LIBRARIES
+    NAMES zstd
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd DEFAULT_MSG
+    ZSTD_LIBRARIES
+    ZSTD_INCLUDE_DIR
+)
+
+mark_as_advanced(
+    ZSTD_INCLUDE_DIR
+    ZSTD_LIBRARIES
+)
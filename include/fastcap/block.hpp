@@ -0,0 +1,107 @@
+#ifndef FASTCAP_BLOCK_HPP
+#define FASTCAP_BLOCK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Version 2 of the fastcap format: the magic number, the lead in the first file, then blocks of
+// entries. The entries inside a block are encoded like the back to back entries of a version 1
+// file, which has no blocks, except that stats entries carry the whole StatHdr. Version 1 stats
+// entries stop after os_drops (STAT_V1_LEN).
+//
+// Every block starts with a header describing it and ends with a footer, so a reader can skip
+// blocks by their header without parsing them, resynchronize on the next sync marker after a
+// corrupt block, and tell a block cut short by a crash from a complete one. Writers emit one
+// block per run of entries they take from the ring.
+//
+// With BLOCK_COMPACT (--entry-format compact) entries are instead encoded as varints relative to
+// the entry before them, or to the header's first ID and timestamp for the first one:
+//
+//   packet: tag, timestamp delta, caplen, [len,] data
+//   stats:  tag, timestamp delta, recv, iface_drops, os_drops, suppressed, queue_drops
+//
+// where tag is the ID delta << 2 | 2 for stats | 1 when len is present, since it is left out
+// when it equals caplen, and the timestamp delta is zigzag encoded nanoseconds.
+
+constexpr uint32_t MAGIC_V1 = 0x46434150;
+constexpr uint32_t MAGIC_V2 = 0x46433250;
+
+// id, secs, frac, recv, iface_drops and os_drops
+constexpr size_t STAT_V1_LEN = 6 * sizeof(uint64_t);
+
+constexpr uint32_t BLOCK_COMPACT = 1;
+// fractions of a second decode to nanoseconds rather than microseconds
+constexpr uint32_t BLOCK_NANO = 2;
+
+// longest compact encoding of a stats entry, packets are shorter
+constexpr size_t COMPACT_MAX_LEN = 7 * 10;
+
+// "FCBLOCK>" and "<FCBLOCK" in memory order on little endian hosts
+constexpr uint64_t BLOCK_SYNC = 0x3E4B434F4C424346;
+constexpr uint64_t BLOCK_END = 0x4B434F4C4243463C;
+
+struct BlockHdr {
+    uint64_t sync;
+    // stats entries count too, without their flag bit
+    uint64_t first_id;
+    uint64_t last_id;
+    // nanoseconds since the epoch, whatever precision the capture has
+    uint64_t first_ts;
+    uint64_t last_ts;
+    // bytes of entries between the header and the footer
+    uint64_t len;
+    uint32_t count;
+    // CRC32C of the entries
+    uint32_t crc;
+    uint32_t flags;
+    // CRC32C of the header up to here
+    uint32_t hdr_crc;
+};
+
+struct BlockFtr {
+    // header, entries and footer, so the block can be found from its end
+    uint64_t block_len;
+    uint64_t end;
+};
+
+static_assert(sizeof(BlockHdr) == 64);
+static_assert(sizeof(BlockFtr) == 16);
+
+// Sidecar index of a version 2 file, written as the capture goes: INDEX_MAGIC followed by one
+// IndexEntry for the first block at or after every --index-interval MiB of the file. Files
+// written with --compression have none, their blocks don't start at fixed offsets.
+constexpr uint32_t INDEX_MAGIC = 0x46434958;
+
+struct IndexEntry {
+    // of the block header in the capture file
+    uint64_t offset;
+    uint64_t first_id;
+    uint64_t first_ts;
+};
+
+inline std::string index_path(const std::string& path) {
+    return path + ".idx";
+}
+
+inline size_t put_varint(uint8_t* out, uint64_t v) {
+    size_t n = 0;
+    for (; v >= 0x80; v >>= 7) {
+        out[n++] = static_cast<uint8_t>(v | 0x80);
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+inline uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// CRC32C (Castagnoli), continuing from crc, the CRC of whatever came before, 0 to start
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+#endif
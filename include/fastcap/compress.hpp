@@ -0,0 +1,63 @@
+#ifndef FASTCAP_COMPRESS_HPP
+#define FASTCAP_COMPRESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A compressed capture file is a sequence of frames, each holding one compressed block of the
+// plain fastcap byte stream, magic number included. Frames are decodable on their own, so a
+// reader can decompress the next ones while it parses the current one.
+
+enum class Codec : uint8_t {
+    // stored as is, used for blocks that don't compress
+    none = 0,
+    lz4 = 1,
+    zstd = 2,
+};
+
+constexpr uint32_t FRAME_MAGIC = 0x4643465A;
+constexpr uint32_t FRAME_MAGIC_SWAPPED = 0x5A464346;
+
+struct FrameHdr {
+    uint32_t magic;
+    uint8_t codec;
+    uint8_t reserved[3];
+    // size of the block before and after compression
+    uint32_t raw_len;
+    uint32_t data_len;
+    // header, data and any padding up to the next frame
+    uint32_t frame_len;
+};
+
+// codec names accepted by --compression in this build, "none" first
+std::vector<std::string> compression_codecs();
+
+class Compressor {
+  private:
+    Codec codec_{Codec::none};
+    int level_{0};
+    void* zstd_ctx_{nullptr};
+
+  public:
+    Compressor(const std::string& name, int level);
+    Compressor(const Compressor&) = delete;
+    Compressor(Compressor&&) = delete;
+    ~Compressor();
+    Compressor& operator=(const Compressor&) = delete;
+    Compressor& operator=(Compressor&&) = delete;
+
+    Codec codec() const;
+
+    // largest compressed size for len bytes of input
+    size_t bound(size_t len) const;
+
+    // returns the compressed size, 0 if it failed or didn't shrink the block
+    size_t compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+};
+
+// decompresses exactly raw_len bytes, false if the data is corrupt or the codec isn't built in
+bool decompress(Codec codec, const uint8_t* src, size_t len, uint8_t* dst, size_t raw_len);
+
+#endif
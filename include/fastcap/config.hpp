@@ -2,19 +2,53 @@
 #define FASTCAP_CONFIG_HPP
 
 #include <string>
+#include <vector>
 
 struct Config {
     std::string iface;
     std::string fname;
     std::string filter;
+    std::string backend{"pcap"};
+    std::string fanout{"hash"};
+    std::string xdp_mode{"auto"};
+    std::string huge_pages{"off"};
+    std::string pipeline{"shared"};
+    std::string capture_cpus;
+    std::string writer_cpus;
+    std::vector<std::string> volumes;
+    std::string io_backend{"buffered"};
+    std::string format{"fastcap"};
+    std::string compression{"none"};
+    std::string overflow{"drop"};
+    std::string entry_format{"full"};
     int bufsz{256};
     int snaplen{65536};
     int num_files{1};
+    int capture_threads{1};
+    int block_size{1024};
+    int block_timeout{100};
+    int xdp_frame_size{4096};
+    int spin_count{2000};
+    int yield_count{16};
+    int shard_run{64};
+    int io_depth{8};
+    int io_block_size{1024};
+    int flush_timeout{100};
+    int dirty_limit{64};
+    int index_interval{16};
+    int rotate_size{0};
+    int rotate_interval{0};
+    int segment_count{0};
+    int compression_level{3};
+    int slice{-1};
+    int dedup_window{0};
+    int spill_size{64};
     float stats_interval{-1.0f};
     bool nano{false};
     bool promisc{false};
     bool rfmon{false};
     bool immediate{false};
+    bool lock_memory{false};
 };
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef FASTCAP_DEDUP_HPP
+#define FASTCAP_DEDUP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Drops packets seen twice within --dedup-window, as SPAN ports and TAPs mirroring both
+// directions of a routed link tend to deliver them. Packets are hashed from the network header
+// on with the TTL or hop limit and the IPv4 checksum left out, since those change between the
+// two copies, and looked up in a fixed size table that only remembers the last packet per slot.
+// Each capture thread has its own, so only the suppressed count is shared.
+class Deduplicator {
+  private:
+    struct Slot {
+        uint64_t hash;
+        uint64_t ts;
+    };
+
+    int datalink_;
+    uint64_t window_;
+    uint64_t frac_scale_;
+    std::vector<Slot> slots_;
+    // read by whichever capture thread writes the stats entry
+    std::atomic<uint64_t> suppressed_{0};
+
+  public:
+    Deduplicator(int datalink, uint64_t window_us, bool nano);
+
+    // true if the packet repeats one within the window and should not be written
+    bool duplicate(uint64_t secs, uint64_t frac, uint32_t len, const uint8_t* pkt, uint32_t caplen);
+
+    uint64_t suppressed() const;
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FASTCAP_MEMORY_HPP
+#define FASTCAP_MEMORY_HPP
+
+#include <fastcap/config.hpp>
+
+#include <cstddef>
+
+// Large capture buffers are backed by huge pages when --huge-pages asks for them, falling back to
+// transparent huge pages if none are reserved. They are pre-faulted, and locked with
+// --lock-memory, so the first pass through them doesn't fault on the capture path.
+
+// buffer of at least size bytes, size is rounded up to the page size it is backed by, node is
+// the NUMA node to prefer for it unless negative
+void* map_buffer(size_t& size, const Config& config, int node);
+
+// like map_buffer, but the memory is mapped a second time right after the first, so
+// 2 * size bytes have to be unmapped
+void* map_mirrored_buffer(size_t& size, const Config& config, int node);
+
+void unmap_buffer(void* mem, size_t size);
+
+#endif
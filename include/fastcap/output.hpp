@@ -0,0 +1,122 @@
+#ifndef FASTCAP_OUTPUT_HPP
+#define FASTCAP_OUTPUT_HPP
+
+#include <fastcap/compress.hpp>
+#include <fastcap/config.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Capture file written in large aligned blocks: entries are copied into a block, which goes
+// out with one write once it is full or the writer flushes it. The buffered backend writes
+// through the page cache from a single block, --io-backend uring keeps several blocks in
+// flight with O_DIRECT and reuses each once its write completes.
+//
+// --io-backend stream writes like the buffered backend, but starts writeback of every half of
+// --dirty-limit as soon as it is written and drops the half before it from the page cache once
+// it is on disk, so long captures neither push other data out of memory nor leave the kernel
+// a large backlog of dirty pages to write back at once.
+//
+// With --compression, data is staged uncompressed and every full or flushed block is written as
+// one compressed frame, see compress.hpp.
+class OutputFile {
+  private:
+    std::string path_;
+    int fd_{-1};
+    bool failed_{false};
+
+    // sidecar index, opened with the first checkpoint
+    int index_fd_{-1};
+    uint64_t index_interval_{0};
+    uint64_t next_checkpoint_{0};
+
+    // io_uring state, unused by the buffered backend
+    int ring_fd_{-1};
+    void* sq_map_{nullptr};
+    size_t sq_map_len_{0};
+    void* cq_map_{nullptr};
+    size_t cq_map_len_{0};
+    io_uring_sqe* sqes_{nullptr};
+    size_t sqes_len_{0};
+    uint32_t* sq_tail_{nullptr};
+    uint32_t* sq_mask_{nullptr};
+    uint32_t* sq_array_{nullptr};
+    uint32_t* cq_head_{nullptr};
+    uint32_t* cq_tail_{nullptr};
+    uint32_t* cq_mask_{nullptr};
+    io_uring_cqe* cqes_{nullptr};
+    bool fixed_buffers_{false};
+    bool direct_{false};
+
+    // streaming writeback state, stream_chunk_ is 0 unless --io-backend stream
+    uint64_t stream_chunk_{0};
+    uint64_t synced_{0};
+    uint64_t dropped_{0};
+
+    uint8_t* blocks_{nullptr};
+    size_t blocks_len_{0};
+    size_t block_size_{0};
+    std::vector<uint32_t> free_blocks_;
+    std::vector<uint32_t> block_lens_;
+    int64_t cur_block_{-1};
+    size_t fill_{0};
+    // part of the current block already on disk
+    size_t flushed_{0};
+    uint64_t offset_{0};
+    uint64_t size_{0};
+    size_t in_flight_{0};
+
+    std::unique_ptr<Compressor> compressor_;
+    std::vector<uint8_t> raw_;
+    size_t raw_fill_{0};
+
+    bool setup_uring(const Config& config);
+    bool setup_blocks(const Config& config, int node, size_t count, size_t block_size);
+    bool acquire();
+    void submit(uint32_t block, uint32_t len);
+    void reap(bool wait);
+    void write_frame();
+    void stream_writeback();
+
+  public:
+    OutputFile(const std::string& path, const Config& config, int node);
+    OutputFile(const OutputFile&) = delete;
+    OutputFile(OutputFile&&) = delete;
+    ~OutputFile();
+    OutputFile& operator=(const OutputFile&) = delete;
+    OutputFile& operator=(OutputFile&&) = delete;
+
+    bool ok() const;
+
+    // bytes appended so far, or written out so far when compressing
+    uint64_t size() const;
+
+    // reserves disk space for len bytes up front without changing the file size
+    void preallocate(uint64_t len);
+
+    // records that a block with these first ID and timestamp starts at the current size in the
+    // sidecar index, if --index-interval has passed since the last one
+    void checkpoint(uint64_t first_id, uint64_t first_ts);
+
+    // appends, returns false once any write has failed
+    bool write(const iovec* iov, size_t count);
+
+    // true when the current block holds data that has not been written yet
+    bool pending() const;
+
+    // writes out the partly filled block, with O_DIRECT its unaligned tail is kept and written
+    // again as the start of the next block
+    void flush();
+
+    // flushes, waits for all writes to finish and closes the file
+    void close();
+};
+
+#endif
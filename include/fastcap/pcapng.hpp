@@ -1,30 +1,59 @@
 #ifndef FASTCAP_PCAPNG_HPP
 #define FASTCAP_PCAPNG_HPP
 
+#include <fastcap/device.hpp>
 #include <fastcap/reader.hpp>
 
 #include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// capture metadata that goes into the section header and interface description blocks
+struct PcapNGInfo {
+    std::string cpu_model;
+    std::string os_version;
+    std::string dev_name;
+    bool nano{false};
+    std::string filter;
+    int snaplen{0};
+    std::vector<IPv4Subnet> ipv4s;
+    std::vector<IPv6Subnet> ipv6s;
+    std::optional<MAC> mac;
+    std::string hardware;
+    uint64_t speed{0};
+    uint16_t link{0};
+    // timestamps are relative to this when it isn't 0
+    uint64_t start_sec{0};
+};
+
+// The block encoders below are shared by fastcap build and the writers' direct PCAPNG output,
+// which frames packet data that is still in the capture buffers without copying it first.
+
+void append_shb(std::vector<uint8_t>& out, const PcapNGInfo& info);
+void append_idb(std::vector<uint8_t>& out, const PcapNGInfo& info);
+
+// enhanced packet block up to the packet data
+constexpr size_t EPB_HEADER_LEN = 28;
+void encode_epb_header(uint8_t* out, const PcapNGInfo& info, uint64_t secs, uint64_t frac, uint32_t len, uint32_t caplen);
+
+// padding and trailing block length after caplen bytes of packet data, returns its length
+constexpr size_t EPB_TRAILER_MAX_LEN = 7;
+size_t encode_epb_trailer(uint8_t* out, uint32_t caplen);
+
+constexpr size_t ISB_LEN = 76;
+void encode_isb(uint8_t* out, const PcapNGInfo& info, const StatHdr& hdr);
 
 class PcapNGWriter {
   private:
     std::ofstream file_;
     ReaderSet* readers_;
-    uint64_t start_time_{0};
+    PcapNGInfo info_;
     uint64_t pkt_count_{0};
 
     void write(const void* buf, std::streamsize len);
 
-    template <typename T>
-    void write(const T* buf);
-
-    std::streamoff position();
-    void seek(std::streamoff pos);
-
-    std::pair<uint32_t, uint32_t> timestamp(uint64_t sec, uint64_t frac);
-
-    void write_shb();
-    void write_idb();
-    void write_epb(const PktHdr& hdr, const std::vector<uint8_t>& data);
+    void write_epb(const PktHdr& hdr, const ByteSpan& data);
     void write_isb(const StatHdr& hdr);
 
   public:
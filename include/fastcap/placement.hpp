@@ -0,0 +1,27 @@
+#ifndef FASTCAP_PLACEMENT_HPP
+#define FASTCAP_PLACEMENT_HPP
+
+#include <fastcap/config.hpp>
+
+#include <vector>
+
+// where capture and writer threads run and where their buffers live, empty CPU lists leave
+// threads unpinned and a negative node leaves memory wherever the kernel puts it
+struct Placement {
+    int node{-1};
+    std::vector<int> capture_cpus;
+    std::vector<int> writer_cpus;
+
+    // CPU for the idx-th thread of a kind, -1 if unpinned
+    static int cpu(const std::vector<int>& cpus, size_t idx);
+};
+
+// Explicit CPU lists from the config win. Otherwise threads are spread over the physical
+// cores of the interface's NUMA node, capture threads first and writers on the cores after
+// them. Returns false if an explicit list is invalid.
+bool plan_placement(const Config& config, Placement& placement);
+
+// pins the calling thread, does nothing for a negative cpu
+void pin_thread(int cpu);
+
+#endif
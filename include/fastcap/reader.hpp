@@ -1,21 +1,62 @@
 #ifndef FASTCAP_READER_HPP
 #define FASTCAP_READER_HPP
 
+#include <fastcap/block.hpp>
 #include <fastcap/device.hpp>
 #include <fastcap/writer.hpp>
 
+#include <istream>
+#include <memory>
 #include <variant>
 
 class ReaderSet;
+class MappedBuf;
 
+// Bytes owned by someone else, see ReaderSet::next.
+struct ByteSpan {
+    const uint8_t* data;
+    size_t size;
+};
+
+// Reads version 1 files as one stream of entries and version 2 files a block at a time, parsing
+// entries out of a block only once its CRC checks out. Corrupt blocks are skipped up to the
+// next sync marker, and a file cut short ends with its last complete block.
+//
+// Seeking jumps to the closest checkpoint in the file's sidecar index, if it has one, and then
+// skips whole version 2 blocks by their headers before parsing the entries of the one it lands in.
+//
+// A mapped Reader maps an uncompressed file into memory instead of reading it, and its payloads
+// and blocks point into the mapping. Compressed files are always read through a stream.
 class Reader {
   private:
-    std::ifstream file_;
+    std::string path_;
+    // decompresses the file's frames when it was captured with --compression
+    std::unique_ptr<std::streambuf> frames_;
+    std::unique_ptr<MappedBuf> mapped_;
+    std::unique_ptr<std::istream> file_;
     std::variant<PktHdr, StatHdr> hdr_;
     std::vector<uint8_t> data_;
+    // the current packet's bytes, in data_ or the mapping
+    const uint8_t* payload_{nullptr};
+    size_t payload_len_{0};
     int native_{0};
+    int version_{1};
     bool has_lead_{false};
     bool done_{false};
+    // entries of the current block, reads come from here rather than the file while in_block_.
+    // Points into block_buf_, or into the mapping when mapped.
+    std::vector<uint8_t> block_buf_;
+    const uint8_t* block_data_{nullptr};
+    size_t block_len_{0};
+    size_t block_pos_{0};
+    bool in_block_{false};
+    // compact entries are decoded relative to the entry before them
+    uint32_t block_flags_{0};
+    uint64_t prev_id_{0};
+    uint64_t prev_ts_{0};
+    uint64_t block_last_id_{0};
+    uint64_t block_last_ts_{0};
+    std::vector<IndexEntry> index_;
 
     friend class ReaderSet;
 
@@ -26,9 +67,21 @@ class Reader {
     void read(T* buf);
 
     void read_next();
+    void set_payload(const uint8_t* data, size_t len);
+    bool next_block();
+    bool valid(const BlockHdr& hdr) const;
+    bool resync(BlockHdr& hdr);
+    bool read_varint(uint64_t& v);
+    bool read_compact();
+    void load_index();
+    // to the first entry whose ID, or timestamp in nanoseconds when by_time, is at least target
+    void seek(bool by_time, uint64_t target, bool nano);
 
   public:
-    explicit Reader(const std::string& path);
+    Reader(const std::string& path, bool mapped);
+    Reader(Reader&&) noexcept;
+    Reader& operator=(Reader&&) noexcept;
+    ~Reader();
 };
 
 class ReaderSet {
@@ -48,14 +101,27 @@ class ReaderSet {
     uint16_t link_{0};
     uint64_t start_sec_{0};
     uint64_t start_frac_{0};
+    bool has_start_{false};
     uint64_t next_{1};
+    // the last packet handed out when not mapped
+    std::vector<uint8_t> held_;
 
     void read_lead(Reader& r);
+    void seeked();
 
   public:
-    ReaderSet(const std::vector<std::string>& paths);
+    // mapped maps the uncompressed files rather than reading them, see Reader
+    ReaderSet(const std::vector<std::string>& paths, bool mapped = false);
 
     std::optional<std::variant<PktHdr, StatHdr>> next(std::vector<uint8_t>& data);
+    // Same, but a packet's bytes are not copied. When mapped they point into the file's mapping
+    // and stay valid as long as the ReaderSet does, otherwise only until the next call.
+    std::optional<std::variant<PktHdr, StatHdr>> next(ByteSpan& data);
+
+    // skip ahead so that next returns entries from this ID, or from this time on (in the
+    // capture's precision), without reading the entries before them where the files allow it
+    void seek_id(uint64_t id);
+    void seek_time(uint64_t secs, uint64_t frac);
 
     const std::string& cpu_model() const;
     const std::string& os_version() const;
@@ -1,63 +1,134 @@
 #ifndef FASTCAP_RING_BUFFER_HPP
 #define FASTCAP_RING_BUFFER_HPP
 
+#include <fastcap/config.hpp>
+
 #include <atomic>
-#include <mutex>
-#include <condition_variable>
+#include <chrono>
 #include <cstdint>
+#include <thread>
 #include <vector>
 #include <cstring>
 
+// run of consecutive entries owned by one consumer until it is released
+struct RingSpan {
+    uint64_t begin{0};
+    uint64_t end{0};
+};
+
 // single producer, multiple consumer
+//
+// The memory is mapped twice back to back, so every entry is contiguous in virtual memory even
+// when it wraps around the end of the buffer.
+//
+// Every entry starts with an 8 byte aligned length word. Consumers claim entries by advancing
+// begin_ with a CAS and mark them released in the length word once they are done copying, so
+// they can finish out of order. The producer reclaims released entries in order from tail_.
 class RingBuffer {
   private:
+    static constexpr uint64_t RELEASED = 1ull << 63;
+
     uint8_t* mem_{nullptr};
-    const size_t cap_{0};
-    std::atomic<std::ptrdiff_t> begin_{0};
-    std::atomic<size_t> end_{0};
-    std::atomic<size_t> free_end_{0};
-    size_t write_pos_{0};
-    size_t write_end_{0};
-    std::mutex mut_;
-    std::condition_variable cv_;
-
-    size_t offset_add(size_t pos, size_t offset) const noexcept;
-    size_t decrement(size_t pos) const noexcept;
-    size_t distance(size_t start, size_t end) const noexcept;
-    void write_impl(size_t pos, const void* buf, size_t len);
-    void read_impl(size_t pos, void* buf, size_t len);
+    size_t cap_{0};
+    // monotonic byte positions, only reduced modulo the capacity when touching memory
+    std::atomic<uint64_t> begin_{0};
+    std::atomic<uint64_t> end_{0};
+    uint64_t head_{0};
+    uint64_t tail_{0};
+    uint8_t* write_ptr_{nullptr};
+    uint64_t write_end_{0};
+    // consumers park on wake_seq_ with a futex, producers only enter the kernel when sleepers_ > 0
+    std::atomic<uint32_t> wake_seq_{0};
+    std::atomic<uint32_t> sleepers_{0};
+    uint32_t spin_count_{0};
+    uint32_t yield_count_{0};
+    bool single_consumer_{false};
+
+    size_t index(uint64_t pos) const noexcept;
+    uint64_t* length_word(uint64_t pos) const noexcept;
+    static uint64_t entry_size(uint64_t len) noexcept;
+    void reclaim();
+    bool empty() const noexcept;
+    // waits at most timeout when it is not negative
+    void futex_wait(uint32_t seq, std::chrono::nanoseconds timeout);
+    void futex_wake(int count);
+    static void cpu_relax() noexcept;
 
   public:
-    explicit RingBuffer(size_t capacity);
+    // an idle consumer spins config.spin_count times, then yields config.yield_count times,
+    // before sleeping, the memory is allocated on NUMA node node unless it is negative
+    //
+    // with single_consumer set, claims are plain stores instead of CAS loops
+    RingBuffer(size_t capacity, const Config& config, int node, bool single_consumer);
     RingBuffer(const RingBuffer&) = delete;
     RingBuffer(RingBuffer&&) = delete;
     ~RingBuffer();
     RingBuffer& operator=(const RingBuffer&) = delete;
     RingBuffer& operator=(RingBuffer&&) = delete;
 
+    bool ok() const;
+
+    // fraction of the buffer published but not yet claimed by a consumer, safe from any thread
+    double occupancy() const;
+
     void notify_one_consumer();
     void notify_all_consumers();
 
-    bool prepare_write(size_t num_bytes);
+    // entries are written with prepare_write, write_some and commit_write, but consumers
+    // only see them once publish is called, so a whole burst costs one store and one wakeup
+    //
+    // prepare_write returns where the entry's num_bytes go, or nullptr if the buffer is full
+    uint8_t* prepare_write(size_t num_bytes);
     void write_some(const void* buf, size_t len);
     void commit_write();
+    void publish();
 
     bool try_read(std::vector<uint8_t>& buf);
     void read(std::vector<uint8_t>& buf);
 
+    // claims up to max_bytes worth of whole entries (always at least one) without copying them
+    bool try_claim(RingSpan& span, size_t max_bytes);
+    void release(const RingSpan& span);
+
+    // calls f(data, len) for each entry in the span
+    template <typename F>
+    void for_each_entry(const RingSpan& span, F&& f) const {
+        for (auto pos = span.begin; pos != span.end;) {
+            const auto len = static_cast<size_t>(__atomic_load_n(length_word(pos), __ATOMIC_RELAXED) & ~RELEASED);
+            f(mem_ + index(pos + sizeof(uint64_t)), len);
+            pos += entry_size(len);
+        }
+    }
+
+    template <typename Pred>
+    bool try_claim_while(Pred pred, RingSpan& span, size_t max_bytes) {
+        uint32_t idle = 0;
+        while (!try_claim(span, max_bytes)) {
+            if (!idle_wait(pred, idle)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // like try_claim_while, but also gives up once nothing has arrived for timeout
+    template <typename Pred>
+    bool try_claim_for(Pred pred, RingSpan& span, size_t max_bytes, std::chrono::nanoseconds timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        uint32_t idle = 0;
+        while (!try_claim(span, max_bytes)) {
+            if (!idle_wait(pred, idle, &deadline)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     template <typename Pred>
     bool try_read_do_while(Pred pred, std::vector<uint8_t>& buf) {
-        bool flag = true;
+        uint32_t idle = 0;
         while (!try_read(buf)) {
-            {
-                std::unique_lock<std::mutex> lock{mut_};
-                cv_.wait(lock, [this, &flag, &pred] {
-                    auto begin = begin_.load(std::memory_order_relaxed);
-                    auto end = static_cast<std::ptrdiff_t>(end_.load(std::memory_order_relaxed));
-                    return !(flag = pred()) || (begin >= 0 && begin != end);
-                });
-            }
-            if (!flag) {
+            if (!idle_wait(pred, idle)) {
                 return false;
             }
         }
@@ -66,9 +137,39 @@ class RingBuffer {
 
     template <typename Pred>
     bool try_read_while(Pred&& pred, std::vector<uint8_t>& buf) {
-        if (!pred()) { return false; }
         return try_read_do_while(std::forward<Pred>(pred), buf);
     }
+
+  private:
+    template <typename Pred>
+    bool idle_wait(Pred& pred, uint32_t& idle, const std::chrono::steady_clock::time_point* deadline = nullptr) {
+        // pred is only consulted once the ring is empty, so stopping drains it first
+        if (!pred()) {
+            return false;
+        }
+        if (idle < spin_count_) {
+            ++idle;
+            cpu_relax();
+        } else if (idle < spin_count_ + yield_count_) {
+            ++idle;
+            std::this_thread::yield();
+        } else {
+            auto timeout = std::chrono::nanoseconds{-1};
+            if (deadline != nullptr) {
+                timeout = *deadline - std::chrono::steady_clock::now();
+                if (timeout.count() <= 0) {
+                    return false;
+                }
+            }
+            sleepers_.fetch_add(1);
+            const auto seq = wake_seq_.load();
+            if (empty() && pred()) {
+                futex_wait(seq, timeout);
+            }
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
 };
 
 #endif
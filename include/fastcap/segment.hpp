@@ -0,0 +1,72 @@
+#ifndef FASTCAP_SEGMENT_HPP
+#define FASTCAP_SEGMENT_HPP
+
+#include <fastcap/config.hpp>
+#include <fastcap/output.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Rotates every writer's output through numbered segment files, e.g. out.0-000003.fcap.
+//
+// A background thread keeps the next segment of each writer open, preallocated and already
+// holding the file header, so rotating only swaps a pointer. It also closes retired segments
+// and, with --segment-count, deletes the oldest ones to bound disk use. Every segment starts
+// with the lead record, so any run of segments can be read on its own.
+class SegmentRotator {
+  private:
+    struct Slot {
+        std::string stem;
+        std::string ext;
+        uint64_t next_seg{0};
+        std::unique_ptr<OutputFile> next;
+        std::string next_path;
+        std::atomic<bool> ready{false};
+        std::vector<std::unique_ptr<OutputFile>> retired;
+        // segments of this writer still on disk, oldest first
+        std::deque<std::string> paths;
+    };
+
+    Config config_;
+    int node_;
+    std::vector<uint8_t> header_;
+    uint64_t prealloc_{0};
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_{false};
+
+    std::unique_ptr<OutputFile> open(Slot& slot, std::string& path);
+    void work();
+
+  public:
+    // paths are the writers' file names, header is written at the start of every segment
+    SegmentRotator(const Config& config, int node, const std::vector<std::string>& paths, std::vector<uint8_t> header);
+    SegmentRotator(const SegmentRotator&) = delete;
+    SegmentRotator(SegmentRotator&&) = delete;
+    ~SegmentRotator();
+    SegmentRotator& operator=(const SegmentRotator&) = delete;
+    SegmentRotator& operator=(SegmentRotator&&) = delete;
+
+    // opens writer idx's first segment on the calling thread
+    std::unique_ptr<OutputFile> first(size_t idx);
+
+    void start();
+
+    // swaps out for the prepared next segment and hands the old one over to be closed, returns
+    // false without blocking if the next segment isn't ready yet
+    bool rotate(size_t idx, std::unique_ptr<OutputFile>& out);
+
+    // closes retired segments and removes prepared ones that were never used
+    void stop();
+};
+
+#endif
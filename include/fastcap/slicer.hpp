@@ -0,0 +1,25 @@
+#ifndef FASTCAP_SLICER_HPP
+#define FASTCAP_SLICER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Cuts packets right after a fixed number of payload bytes for --slice. Headers are walked
+// through VLAN and MPLS tags, IPv4 options, IPv6 extension headers, and VXLAN, GRE and IP in IP
+// tunnels, so everything up to the innermost transport header is always kept.
+class Slicer {
+  private:
+    int datalink_;
+    uint32_t payload_;
+
+  public:
+    Slicer(int datalink, uint32_t payload);
+
+    // caplen to record for a packet with caplen captured bytes
+    uint32_t slice(const uint8_t* pkt, uint32_t caplen) const;
+};
+
+// bytes of protocol headers at the start of a packet, or caplen if they don't fit in it
+size_t header_length(int datalink, const uint8_t* pkt, size_t caplen);
+
+#endif
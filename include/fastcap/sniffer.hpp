@@ -2,10 +2,14 @@
 #define FASTCAP_SNIFFER_HPP
 
 #include <fastcap/config.hpp>
+#include <fastcap/placement.hpp>
 #include <fastcap/writer.hpp>
 
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <sys/time.h>
 
@@ -15,9 +19,13 @@ struct pcap_pkthdr;
 struct bpf_program;
 }
 
+class TPacketRing;
+class XdpProgram;
+class XdpSocket;
+
 class Sniffer {
   public:
-    explicit Sniffer(const Config& cfg);
+    Sniffer(const Config& cfg, const Placement& placement);
     Sniffer(const Sniffer&) = delete;
     Sniffer(Sniffer&& other) = delete;
     ~Sniffer();
@@ -30,18 +38,39 @@ class Sniffer {
     int run(WriterSet& writers);
     int stop();
 
-    void sniff_callback(WriterSet& writers, const pcap_pkthdr& hdr, const uint8_t* bytes);
+    void sniff_callback(Producer& producer, const pcap_pkthdr& hdr, const uint8_t* bytes);
 
   private:
-    void stats(WriterSet& writers);
+    void open_pcap(const Config& config);
+    void open_tpacket(const Config& config);
+    void open_xdp(const Config& config, int node);
+    int run_pcap(Producer& producer);
+    template <typename Socket>
+    int run_sockets(std::vector<std::unique_ptr<Socket>>& sockets, WriterSet& writers);
+    template <typename Socket>
+    int capture_socket(Socket& socket, Producer& producer, bool do_stats, bool& just_did_stats);
+    template <typename Socket>
+    bool socket_stats(std::vector<std::unique_ptr<Socket>>& sockets, uint64_t& recv, uint64_t& os_drops, uint64_t& last_ts);
+    uint64_t iface_drops();
+    void stats(Producer& producer);
 
     pcap* pcap_{nullptr};
+    std::vector<std::unique_ptr<TPacketRing>> tpackets_;
+    std::unique_ptr<XdpProgram> xdp_;
+    std::vector<std::unique_ptr<XdpSocket>> xsks_;
     bpf_program* prog_{nullptr};
     int stop_event_{-1};
     std::atomic<bool> stop_flag_{false};
     float stats_interval_{0.0f};
     timeval last_ts_{};
     int datalink_{0};
+    bool nano_{false};
+    std::string iface_;
+    uint64_t base_iface_drops_{0};
+    // last raw counter value, and the drops counted before the counter was last reset
+    uint64_t last_iface_drops_{0};
+    uint64_t carried_iface_drops_{0};
+    std::vector<int> capture_cpus_;
 };
 
 #endif
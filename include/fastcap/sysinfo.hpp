@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <string>
 #include <string_view>
+#include <vector>
 
 std::string cpu_model();
 
@@ -13,4 +14,22 @@ std::string iface_hardware(std::string_view iface);
 
 uint64_t iface_speed(std::string_view iface);
 
+uint64_t iface_rx_dropped(std::string_view iface);
+
+int iface_link_type(std::string_view iface);
+
+size_t iface_rx_queues(std::string_view iface);
+
+// -1 if the interface isn't attached to a specific NUMA node
+int iface_numa_node(std::string_view iface);
+
+// parses lists like "0-3,8,10-11", returns an empty list if it is malformed
+std::vector<int> parse_cpu_list(std::string_view list);
+
+// online CPUs on a NUMA node, or all online CPUs if node is negative
+std::vector<int> node_cpus(int node);
+
+// true for the lowest numbered hardware thread of each physical core
+bool cpu_is_primary_thread(int cpu);
+
 #endif
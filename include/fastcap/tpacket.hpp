@@ -0,0 +1,49 @@
+#ifndef FASTCAP_TPACKET_HPP
+#define FASTCAP_TPACKET_HPP
+
+#include <fastcap/config.hpp>
+#include <fastcap/writer.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// AF_PACKET socket with a TPACKET_V3 block ring mapped into user space
+class TPacketRing {
+  private:
+    int fd_{-1};
+    uint8_t* ring_{nullptr};
+    size_t block_size_{0};
+    size_t block_count_{0};
+    size_t cur_block_{0};
+    uint32_t snaplen_{0};
+    bool nano_{false};
+    int datalink_{0};
+    uint64_t recv_{0};
+    uint64_t os_drops_{0};
+    std::atomic<uint64_t> last_ts_{0};
+    std::vector<uint8_t> scratch_;
+
+    void write_block(Producer& producer, uint8_t* block);
+
+  public:
+    // fanout_id joins the socket to that PACKET_FANOUT group unless negative
+    TPacketRing(const Config& config, int fanout_id);
+    TPacketRing(const TPacketRing&) = delete;
+    TPacketRing(TPacketRing&&) = delete;
+    ~TPacketRing();
+    TPacketRing& operator=(const TPacketRing&) = delete;
+    TPacketRing& operator=(TPacketRing&&) = delete;
+
+    bool ok() const;
+    int fd() const;
+    int datalink() const;
+    int poll_timeout() const;
+    uint64_t last_timestamp() const;
+
+    int dispatch(Producer& producer);
+    bool stats(uint64_t& recv, uint64_t& os_drops);
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef FASTCAP_VOLUME_HPP
+#define FASTCAP_VOLUME_HPP
+
+#include <fastcap/config.hpp>
+
+#include <string>
+#include <vector>
+
+// directory that a share of the capture files is written to, usually its own mount point
+struct Volume {
+    std::string dir;
+    // relative share of the entries its writers should take
+    double weight{1.0};
+};
+
+// Parses the --volume DIR[:WEIGHT] list. Volumes without a weight are weighed by writing a
+// short test file to them and timing it, so they need to be writable before capture starts.
+// Returns false if a volume is invalid or can't be written to.
+bool plan_volumes(const Config& config, std::vector<Volume>& volumes);
+
+// Volume index for each of file_count files, every volume getting at least one. When the files'
+// writers are weighted already, as by the sharded pipeline's runs, the volumes take turns.
+// Otherwise each volume gets a number of files, and so of writer threads, in proportion to its
+// weight.
+std::vector<size_t> assign_files(const std::vector<Volume>& volumes, size_t file_count, bool weighted_files);
+
+#endif
@@ -2,12 +2,19 @@
 #define FASTCAP_WRITER_HPP
 
 #include <fastcap/config.hpp>
+#include <fastcap/dedup.hpp>
+#include <fastcap/output.hpp>
+#include <fastcap/placement.hpp>
 #include <fastcap/ring_buffer.hpp>
+#include <fastcap/segment.hpp>
+#include <fastcap/slicer.hpp>
+#include <fastcap/volume.hpp>
 
 #include <atomic>
 #include <thread>
 #include <cstdint>
-#include <fstream>
+#include <memory>
+#include <string>
 #include <vector>
 
 extern "C" {
@@ -16,6 +23,8 @@ struct pcap_pkthdr;
 }
 
 class WriterSet;
+class Umem;
+struct PcapNGInfo;
 
 struct PktHdr {
     uint64_t id;
@@ -32,46 +41,140 @@ struct StatHdr {
     uint64_t recv;
     uint64_t iface_drops;
     uint64_t os_drops;
+    // version 1 files end stats entries here (STAT_V1_LEN), the fields below are only in version 2
+    // packets dropped by --dedup-window as duplicates
+    uint64_t suppressed;
+    // packets dropped because the capture thread's ring buffer was full
+    uint64_t queue_drops;
+};
+
+// feeds the ring buffers of one capture thread, either one ring shared by all of its writers
+// or, with --pipeline sharded, one single consumer ring per writer filled in runs of entries
+//
+// An entry that finds the rings full is handled by --overflow: dropped and counted, cut down to
+// its protocol headers, or parked in a spill buffer that is moved into the rings, in order,
+// ahead of any newer entries once the writers catch up.
+class Producer {
+  private:
+    WriterSet* set_;
+    std::vector<std::unique_ptr<RingBuffer>> rings_;
+    RingBuffer* buf_{nullptr};
+    // set while the entry being written goes to the spill buffer instead of buf_
+    uint8_t* spill_ptr_{nullptr};
+    std::vector<uint8_t> spill_;
+    size_t spill_head_{0};
+    size_t spill_tail_{0};
+    const Slicer* truncator_{nullptr};
+    // counted by this producer's capture thread, and summed over all producers by whichever
+    // one writes the stats entry
+    std::atomic<uint64_t> queue_drops_{0};
+    std::atomic<uint64_t> truncated_{0};
+    std::atomic<size_t> spill_used_{0};
+    size_t shard_{0};
+    // entries per run for each shard, longer for writers on faster volumes
+    std::vector<uint32_t> shard_runs_;
+    uint32_t run_left_{0};
+    Umem* umem_{nullptr};
+    const Slicer* slicer_{nullptr};
+    std::unique_ptr<Deduplicator> dedup_;
+    std::vector<std::pair<uint8_t*, uint64_t>> staged_;
+
+    bool prepare(size_t num_bytes, uint64_t flags);
+    uint8_t* ring_entry(size_t num_bytes, uint64_t flags);
+    bool spill_entry(size_t num_bytes, uint64_t flags);
+    void drain_spill();
+    void put(const void* buf, size_t len);
+    void commit();
+    void next_shard();
+
+    friend class Writer;
+    friend class WriterSet;
+
+  public:
+    Producer(WriterSet& set, const Config& config, size_t capacity, size_t shards, int node);
+    Producer(const Producer&) = delete;
+    Producer(Producer&&) = delete;
+    ~Producer() = default;
+    Producer& operator=(const Producer&) = delete;
+    Producer& operator=(Producer&&) = delete;
+
+    void write_packet(const pcap_pkthdr& hdr, const uint8_t* bytes);
+    void write_packet(uint64_t secs, uint64_t frac, uint32_t len, uint32_t caplen, const uint8_t* bytes);
+    void write_stats(const timeval& ts, uint64_t recv, uint64_t iface_drops, uint64_t os_drops);
+
+    // entries for frames in umem only reference the packet data, writers release the frame once
+    // written, the caller keeps frames that weren't queued (returns false)
+    void set_umem(Umem* umem);
+    bool write_frame(uint64_t secs, uint64_t frac, uint32_t len, uint32_t caplen, uint64_t addr);
+
+    // entries written since the last flush get their IDs and become visible to writers together
+    void flush();
+
+    // moves everything still in the spill buffer into the rings, once capture has stopped
+    void drain();
 };
 
 class Writer {
   private:
     std::thread worker_;
-    std::ofstream file_;
+    std::unique_ptr<OutputFile> out_;
     WriterSet* set_;
+    Producer* producer_;
+    RingBuffer* buf_;
+    size_t idx_;
 
     void work();
 
-    void launch_worker();
+    void launch_worker(int cpu);
 
     friend class WriterSet;
 
   public:
-    Writer(WriterSet& set, std::ofstream file);
+    // with rotation enabled, path only names the segments, see SegmentRotator
+    Writer(WriterSet& set, Producer& producer, RingBuffer& buf, size_t idx, const std::string& path);
 
     void join();
 };
 
 class WriterSet {
   private:
+    Config config_;
+    Placement placement_;
+    std::vector<Volume> volumes_;
+    std::vector<std::unique_ptr<Producer>> producers_;
     std::vector<Writer> writers_;
-    RingBuffer buf_;
+    std::unique_ptr<SegmentRotator> rotator_;
+    std::unique_ptr<PcapNGInfo> pcapng_;
+    std::unique_ptr<Slicer> slicer_;
+    std::unique_ptr<Slicer> truncator_;
     std::atomic<bool> stop_{false};
-    uint64_t queue_drops_{0};
-    uint64_t entry_count_{0};
+    std::atomic<uint64_t> entry_count_{0};
 
+    friend class Producer;
     friend class Writer;
 
+    RingBuffer& writer_ring(size_t idx);
+    void log_occupancy() const;
+
   public:
-    WriterSet(const Config& config, int datalink);
+    // buffers are allocated up front, files are only created once start is called
+    //
+    // with volumes, file i goes to volume i % volumes.size() and, with --pipeline sharded, its
+    // writer gets runs of entries in proportion to the volume's weight, with the shared pipeline
+    // writers on faster volumes already claim more entries by draining the ring faster
+    WriterSet(const Config& config, const Placement& placement, const std::vector<Volume>& volumes);
     WriterSet(const WriterSet&) = delete;
     WriterSet(WriterSet&&) = delete;
-    ~WriterSet() = default;
+    ~WriterSet();
     WriterSet& operator=(const WriterSet&) = delete;
     WriterSet& operator=(WriterSet&&) = delete;
 
-    void write_packet(const pcap_pkthdr& hdr, const uint8_t* bytes);
-    void write_stats(const timeval& ts, uint64_t recv, uint64_t iface_drops, uint64_t os_drops);
+    bool ok() const;
+
+    void start(int datalink);
+
+    size_t producer_count() const;
+    Producer& producer(size_t idx);
 
     int join();
 };
@@ -0,0 +1,114 @@
+#ifndef FASTCAP_XDP_HPP
+#define FASTCAP_XDP_HPP
+
+#include <fastcap/config.hpp>
+#include <fastcap/writer.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// frame memory shared between an AF_XDP socket and the writers draining its producer
+class Umem {
+  private:
+    uint8_t* mem_{nullptr};
+    size_t frame_size_{0};
+    size_t frame_count_{0};
+    size_t map_size_{0};
+    std::unique_ptr<std::atomic<uint8_t>[]> released_;
+
+  public:
+    Umem(size_t frame_size, size_t frame_count, const Config& config, int node);
+    Umem(const Umem&) = delete;
+    Umem(Umem&&) = delete;
+    ~Umem();
+    Umem& operator=(const Umem&) = delete;
+    Umem& operator=(Umem&&) = delete;
+
+    bool ok() const;
+    uint8_t* data() const;
+    size_t size() const;
+    size_t frame_size() const;
+    size_t frame_count() const;
+
+    const uint8_t* frame(uint64_t addr) const;
+
+    // called by writers once a frame has been written out
+    void release(uint64_t addr);
+    // called by the capture thread to take a released frame back
+    bool reclaim(uint64_t addr);
+};
+
+// XSKMAP plus the XDP program that redirects every RX queue into its socket
+class XdpProgram {
+  private:
+    int map_fd_{-1};
+    int prog_fd_{-1};
+    int link_fd_{-1};
+    int promisc_fd_{-1};
+    bool native_{false};
+
+  public:
+    XdpProgram(const Config& config, int ifindex, size_t queue_count);
+    XdpProgram(const XdpProgram&) = delete;
+    XdpProgram(XdpProgram&&) = delete;
+    ~XdpProgram();
+    XdpProgram& operator=(const XdpProgram&) = delete;
+    XdpProgram& operator=(XdpProgram&&) = delete;
+
+    bool ok() const;
+    bool native() const;
+
+    bool add_socket(int queue, int fd);
+};
+
+struct XdpRing {
+    uint32_t* producer{nullptr};
+    uint32_t* consumer{nullptr};
+    uint32_t* flags{nullptr};
+    void* descs{nullptr};
+    uint32_t mask{0};
+    void* map{nullptr};
+    size_t map_len{0};
+};
+
+// AF_XDP socket bound to one RX queue
+class XdpSocket {
+  private:
+    int fd_{-1};
+    int queue_{0};
+    Umem umem_;
+    XdpRing rx_;
+    XdpRing fill_;
+    std::vector<uint64_t> pending_;
+    size_t pending_head_{0};
+    size_t pending_count_{0};
+    uint32_t snaplen_{0};
+    bool nano_{false};
+    std::atomic<uint64_t> rx_packets_{0};
+    std::atomic<uint64_t> last_ts_{0};
+
+    void refill();
+
+  public:
+    // node is the NUMA node the frame memory is allocated on, if not negative
+    XdpSocket(const Config& config, int ifindex, int queue, bool zero_copy, int node);
+    XdpSocket(const XdpSocket&) = delete;
+    XdpSocket(XdpSocket&&) = delete;
+    ~XdpSocket();
+    XdpSocket& operator=(const XdpSocket&) = delete;
+    XdpSocket& operator=(XdpSocket&&) = delete;
+
+    bool ok() const;
+    int fd() const;
+    int queue() const;
+    Umem& umem();
+    int poll_timeout() const;
+    uint64_t last_timestamp() const;
+
+    int dispatch(Producer& producer);
+    bool stats(uint64_t& recv, uint64_t& os_drops);
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <fastcap/block.hpp>
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78;
+
+std::array<uint32_t, 256> make_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        auto c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) != 0 ? (c >> 1) ^ POLY : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t len) {
+    static const auto table = make_table();
+    for (; len > 0; ++p, --len) {
+        crc = table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v = 0;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    auto c32 = static_cast<uint32_t>(c);
+    for (; len > 0; ++p, --len) {
+        c32 = _mm_crc32_u8(c32, *p);
+    }
+    return c32;
+}
+
+const bool HAVE_HW = __builtin_cpu_supports("sse4.2");
+#endif
+
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+    auto p = reinterpret_cast<const uint8_t*>(data);
+#if defined(__x86_64__)
+    if (HAVE_HW) {
+        return ~crc32c_hw(~crc, p, len);
+    }
+#endif
+    return ~crc32c_sw(~crc, p, len);
+}
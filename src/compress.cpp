@@ -0,0 +1,115 @@
+#include <fastcap/compress.hpp>
+
+#include <cstring>
+
+#ifdef FASTCAP_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef FASTCAP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+std::vector<std::string> compression_codecs() {
+    std::vector<std::string> codecs{"none"};
+#ifdef FASTCAP_HAVE_LZ4
+    codecs.emplace_back("lz4");
+#endif
+#ifdef FASTCAP_HAVE_ZSTD
+    codecs.emplace_back("zstd");
+#endif
+    return codecs;
+}
+
+Compressor::Compressor([[maybe_unused]] const std::string& name, int level) : level_(level) {
+#ifdef FASTCAP_HAVE_LZ4
+    if (name == "lz4") {
+        codec_ = Codec::lz4;
+    }
+#endif
+#ifdef FASTCAP_HAVE_ZSTD
+    if (name == "zstd") {
+        codec_ = Codec::zstd;
+        zstd_ctx_ = ZSTD_createCCtx();
+    }
+#endif
+}
+
+Compressor::~Compressor() {
+#ifdef FASTCAP_HAVE_ZSTD
+    ZSTD_freeCCtx(reinterpret_cast<ZSTD_CCtx*>(zstd_ctx_));
+#endif
+}
+
+Codec Compressor::codec() const {
+    return codec_;
+}
+
+size_t Compressor::bound(size_t len) const {
+    switch (codec_) {
+#ifdef FASTCAP_HAVE_LZ4
+    case Codec::lz4:
+        return static_cast<size_t>(LZ4_compressBound(static_cast<int>(len)));
+#endif
+#ifdef FASTCAP_HAVE_ZSTD
+    case Codec::zstd:
+        return ZSTD_compressBound(len);
+#endif
+    default:
+        return len;
+    }
+}
+
+size_t Compressor::compress([[maybe_unused]] const uint8_t* src, size_t len, [[maybe_unused]] uint8_t* dst, [[maybe_unused]] size_t cap) {
+    size_t out = 0;
+    switch (codec_) {
+#ifdef FASTCAP_HAVE_LZ4
+    case Codec::lz4: {
+        auto n = LZ4_compress_default(
+            reinterpret_cast<const char*>(src),
+            reinterpret_cast<char*>(dst),
+            static_cast<int>(len),
+            static_cast<int>(cap)
+        );
+        out = n > 0 ? static_cast<size_t>(n) : 0;
+        break;
+    }
+#endif
+#ifdef FASTCAP_HAVE_ZSTD
+    case Codec::zstd: {
+        auto n = ZSTD_compressCCtx(reinterpret_cast<ZSTD_CCtx*>(zstd_ctx_), dst, cap, src, len, level_);
+        out = ZSTD_isError(n) ? 0 : n;
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    return out < len ? out : 0;
+}
+
+bool decompress(Codec codec, const uint8_t* src, size_t len, uint8_t* dst, size_t raw_len) {
+    switch (codec) {
+    case Codec::none:
+        if (len != raw_len) {
+            return false;
+        }
+        std::memcpy(dst, src, len);
+        return true;
+#ifdef FASTCAP_HAVE_LZ4
+    case Codec::lz4:
+        return LZ4_decompress_safe(
+            reinterpret_cast<const char*>(src),
+            reinterpret_cast<char*>(dst),
+            static_cast<int>(len),
+            static_cast<int>(raw_len)
+        ) == static_cast<int>(raw_len);
+#endif
+#ifdef FASTCAP_HAVE_ZSTD
+    case Codec::zstd:
+        return ZSTD_decompress(dst, raw_len, src, len) == raw_len;
+#endif
+    default:
+        return false;
+    }
+}
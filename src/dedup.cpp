@@ -0,0 +1,157 @@
+#include <fastcap/dedup.hpp>
+
+#include <pcap.h>
+
+#include <cstring>
+
+namespace {
+
+// 16 bytes each, so 1 MiB per capture thread
+constexpr size_t SLOT_COUNT = 1 << 16;
+
+constexpr uint64_t K0 = 0x9E3779B97F4A7C15ull;
+constexpr uint64_t K1 = 0xBF58476D1CE4E5B9ull;
+
+uint16_t load16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v * K0;
+    h = (h << 31) | (h >> 33);
+    return h * K1;
+}
+
+uint64_t hash_bytes(uint64_t h, const uint8_t* p, size_t len) {
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v = 0;
+        std::memcpy(&v, p, 8);
+        h = mix(h, v);
+    }
+    if (len > 0) {
+        uint64_t v = 0;
+        std::memcpy(&v, p, len);
+        h = mix(h, v ^ (static_cast<uint64_t>(len) << 56));
+    }
+    return h;
+}
+
+uint64_t finish(uint64_t h) {
+    h ^= h >> 33;
+    h *= K1;
+    h ^= h >> 29;
+    return h;
+}
+
+// finds the network header, skipping whatever the two copies may have rewritten below it
+// (MAC addresses, VLAN tags, MPLS labels), false if the packet isn't IP
+bool network_offset(int datalink, const uint8_t* pkt, size_t caplen, size_t& off) {
+    uint16_t ethertype = 0;
+    switch (datalink) {
+        case DLT_EN10MB:
+            if (caplen < 14) {
+                return false;
+            }
+            ethertype = load16(pkt + 12);
+            off = 14;
+            while (ethertype == 0x8100 || ethertype == 0x88A8 || ethertype == 0x9100) {
+                if (off + 4 > caplen) {
+                    return false;
+                }
+                ethertype = load16(pkt + off + 2);
+                off += 4;
+            }
+            break;
+        case DLT_LINUX_SLL:
+            if (caplen < 16) {
+                return false;
+            }
+            ethertype = load16(pkt + 14);
+            off = 16;
+            break;
+#ifdef DLT_LINUX_SLL2
+        case DLT_LINUX_SLL2:
+            if (caplen < 20) {
+                return false;
+            }
+            ethertype = load16(pkt);
+            off = 20;
+            break;
+#endif
+        case DLT_RAW:
+        case DLT_IPV4:
+        case DLT_IPV6:
+            off = 0;
+            return true;
+        case DLT_NULL:
+        case DLT_LOOP:
+            off = 4;
+            return true;
+        default:
+            return false;
+    }
+    if (ethertype == 0x8847 || ethertype == 0x8848) {
+        for (bool bottom = false; !bottom; off += 4) {
+            if (off + 4 > caplen) {
+                return false;
+            }
+            bottom = (pkt[off + 2] & 1) != 0;
+        }
+        return true;
+    }
+    return ethertype == 0x0800 || ethertype == 0x86DD;
+}
+
+}
+
+Deduplicator::Deduplicator(int datalink, uint64_t window_us, bool nano)
+    : datalink_(datalink),
+      window_(window_us * 1000),
+      frac_scale_(nano ? 1 : 1000),
+      slots_(SLOT_COUNT, Slot{0, 0}) {}
+
+bool Deduplicator::duplicate(uint64_t secs, uint64_t frac, uint32_t len, const uint8_t* pkt, uint32_t caplen) {
+    size_t off = 0;
+    const bool ip = network_offset(datalink_, pkt, caplen, off) && off < caplen;
+    if (!ip) {
+        off = 0;
+    }
+    auto h = mix(K0, (static_cast<uint64_t>(len) << 32) | (caplen - off));
+    size_t skip = off;
+    if (ip) {
+        // copy the fixed IP header aside to blank out the fields that differ between copies
+        uint8_t hdr[40];
+        const auto version = pkt[off] >> 4;
+        size_t hdr_len = 0;
+        if (version == 4 && off + 20 <= caplen) {
+            hdr_len = 20;
+            std::memcpy(hdr, pkt + off, hdr_len);
+            hdr[8] = 0;
+            hdr[10] = 0;
+            hdr[11] = 0;
+        } else if (version == 6 && off + 40 <= caplen) {
+            hdr_len = 40;
+            std::memcpy(hdr, pkt + off, hdr_len);
+            hdr[7] = 0;
+        }
+        h = hash_bytes(h, hdr, hdr_len);
+        skip += hdr_len;
+    }
+    h = finish(hash_bytes(h, pkt + skip, caplen - skip));
+
+    const auto ts = secs * 1'000'000'000 + frac * frac_scale_;
+    auto& slot = slots_[h & (SLOT_COUNT - 1)];
+    // timestamps from different queues can be slightly out of order, so look both ways
+    const auto age = ts >= slot.ts ? ts - slot.ts : slot.ts - ts;
+    if (slot.hash == h && age <= window_) {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    slot.hash = h;
+    slot.ts = ts;
+    return false;
+}
+
+uint64_t Deduplicator::suppressed() const {
+    return suppressed_.load(std::memory_order_relaxed);
+}
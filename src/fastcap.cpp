@@ -1,6 +1,8 @@
 #include <fastcap/sniffer.hpp>
 #include <fastcap/writer.hpp>
 #include <fastcap/pcapng.hpp>
+#include <fastcap/compress.hpp>
+#include <fastcap/volume.hpp>
 
 #include <CLI/CLI.hpp>
 #include <spdlog/spdlog.h>
@@ -45,12 +47,40 @@ void init_signal_handler() {
 
 static int capture(const Config& config) {
     spdlog::trace("Run thread started");
-    Sniffer sniffer{config};
-    WriterSet writers{config, sniffer.datalink()};
+    if (config.capture_threads > 1 && config.backend == "pcap") {
+        spdlog::error("multiple capture threads require the tpacket or xdp backend");
+        return 1;
+    }
+    if (config.capture_threads > config.num_files) {
+        spdlog::error("file count must be at least the number of capture threads");
+        return 1;
+    }
+    if (config.volumes.size() > static_cast<size_t>(config.num_files)) {
+        spdlog::error("file count must be at least the number of volumes");
+        return 1;
+    }
+    if (config.compression != "none" && config.format == "pcapng") {
+        spdlog::error("compression is only supported with the fastcap format");
+        return 1;
+    }
+    Placement placement;
+    if (!plan_placement(config, placement)) {
+        return 1;
+    }
+    std::vector<Volume> volumes;
+    if (!plan_volumes(config, volumes)) {
+        return 1;
+    }
+    // capture buffers are set up before the interface starts delivering packets
+    WriterSet writers{config, placement, volumes};
+    if (!writers.ok()) {
+        return 1;
+    }
+    Sniffer sniffer{config, placement};
     if (!sniffer.ok()) {
-        writers.join();
         return 1;
     }
+    writers.start(sniffer.datalink());
     Sniffer* tmp = nullptr;
     if (g_sniffer.compare_exchange_strong(tmp, &sniffer, std::memory_order_relaxed)) {
         auto rc = sniffer.run(writers);
@@ -68,6 +98,9 @@ int fastcap(int argc, const char* const* argv) {
     std::string log_file;
     std::string pcapng_out;
     std::vector<std::string> pcapng_in;
+    uint64_t start_id = 0;
+    double start_time = -1.0;
+    bool mmap_in = false;
 
     CLI::App app("Fastcap");
     app.add_option("-l,--log-level", log_level, "Logging level: trace, debug, info, warning, error, off")->capture_default_str();
@@ -77,9 +110,42 @@ int fastcap(int argc, const char* const* argv) {
     capture_cmd->add_option("interface", config.iface, "Interface from which to capture network traffic")->required();
     capture_cmd->add_option("output", config.fname, "Output filename")->required();
     capture_cmd->add_option("-c,--file-count", config.num_files, "Number of parallel files to write")->capture_default_str()->check(CLI::Range(1, std::numeric_limits<int>::max()));
+    capture_cmd->add_option("--volume", config.volumes, "Directory to spread the files over, one per volume, as DIR or DIR:WEIGHT (weighed by a short write test if no weight is given)");
     capture_cmd->add_option("-t,--stats-interval", config.stats_interval, "Time between statistics measurements in seconds (defaults to once at the end of capture)")->check(CLI::NonNegativeNumber);
     capture_cmd->add_option("-s,--snaplen", config.snaplen, "Packet snapshot length in bytes")->capture_default_str()->check(CLI::PositiveNumber);
+    capture_cmd->add_option("--slice", config.slice, "Keep only the protocol headers (through VLAN, MPLS and VXLAN/GRE tunnels) and this many payload bytes of each packet")->check(CLI::NonNegativeNumber);
+    capture_cmd->add_option("--dedup-window", config.dedup_window, "Drop packets identical to one captured within this many microseconds, e.g. doubled by a SPAN port (0 disables)")->capture_default_str()->check(CLI::NonNegativeNumber);
     capture_cmd->add_option("-b,--bufsize", config.bufsz, "Buffer size in MiB for capturing packets")->capture_default_str()->check(CLI::Range(1, std::numeric_limits<int>::max() >> (20 - 1)));
+    capture_cmd->add_option("--overflow", config.overflow, "What happens to packets that find the buffer full: drop, spill (queue them in a spill buffer) or truncate (keep only their headers)")->capture_default_str()->check(CLI::IsMember({"drop", "spill", "truncate"}));
+    capture_cmd->add_option("--spill-size", config.spill_size, "Size in MiB of each capture thread's spill buffer with --overflow spill")->capture_default_str()->check(CLI::Range(1, 1 << 16));
+    capture_cmd->add_option("--format", config.format, "Output format: fastcap, or pcapng to skip fastcap build (each file is its own section)")->capture_default_str()->check(CLI::IsMember({"fastcap", "pcapng"}));
+    capture_cmd->add_option("--entry-format", config.entry_format, "How entries are encoded in fastcap files: full (fixed size headers) or compact (delta and varint coded headers)")->capture_default_str()->check(CLI::IsMember({"full", "compact"}));
+    capture_cmd->add_option("--index-interval", config.index_interval, "MiB of each fastcap file between checkpoints in its sidecar .idx index, used to seek (0 disables)")->capture_default_str()->check(CLI::NonNegativeNumber);
+    capture_cmd->add_option("--compression", config.compression, "Compress blocks of the capture files with this codec, decompressed again by build")->capture_default_str()->check(CLI::IsMember(compression_codecs()));
+    capture_cmd->add_option("--compression-level", config.compression_level, "zstd compression level")->capture_default_str()->check(CLI::Range(-7, 22));
+    capture_cmd->add_option("--backend", config.backend, "Capture backend: pcap, tpacket, xdp")->capture_default_str()->check(CLI::IsMember({"pcap", "tpacket", "xdp"}));
+    capture_cmd->add_option("--block-size", config.block_size, "Block size in KiB for the tpacket ring (power of two)")->capture_default_str()->check(CLI::Range(4, 1 << 20));
+    capture_cmd->add_option("--block-timeout", config.block_timeout, "Time in milliseconds after which the kernel retires a partially filled tpacket block")->capture_default_str()->check(CLI::Range(1, 60000));
+    capture_cmd->add_option("-T,--capture-threads", config.capture_threads, "Number of capture threads, joined in a PACKET_FANOUT group (tpacket) or bound to RX queues 0 to N-1 (xdp)")->capture_default_str()->check(CLI::Range(1, 1024));
+    capture_cmd->add_option("--fanout", config.fanout, "How packets are spread across capture threads: hash, cpu, queue")->capture_default_str()->check(CLI::IsMember({"hash", "cpu", "queue"}));
+    capture_cmd->add_option("--xdp-mode", config.xdp_mode, "XDP attach mode: auto, native, skb (packets on captured queues bypass the host network stack)")->capture_default_str()->check(CLI::IsMember({"auto", "native", "skb"}));
+    capture_cmd->add_option("--xdp-frame-size", config.xdp_frame_size, "Size in bytes of each AF_XDP frame")->capture_default_str()->check(CLI::IsMember({2048, 4096}));
+    capture_cmd->add_option("--pipeline", config.pipeline, "How writers get entries: shared (one ring per capture thread) or sharded (one ring per writer)")->capture_default_str()->check(CLI::IsMember({"shared", "sharded"}));
+    capture_cmd->add_option("--shard-run", config.shard_run, "Consecutive entries sent to one writer before moving to the next with --pipeline sharded")->capture_default_str()->check(CLI::Range(1, 1 << 20));
+    capture_cmd->add_option("--spin-count", config.spin_count, "Times an idle writer thread polls its buffer before yielding")->capture_default_str()->check(CLI::NonNegativeNumber);
+    capture_cmd->add_option("--yield-count", config.yield_count, "Times an idle writer thread yields before sleeping until woken")->capture_default_str()->check(CLI::NonNegativeNumber);
+    capture_cmd->add_option("--capture-cpus", config.capture_cpus, "CPUs to pin capture threads to, e.g. 2-3 (defaults to cores on the interface's NUMA node)");
+    capture_cmd->add_option("--writer-cpus", config.writer_cpus, "CPUs to pin writer threads to, e.g. 4-7,12 (defaults to the next cores on the interface's NUMA node)");
+    capture_cmd->add_option("--huge-pages", config.huge_pages, "Back capture buffers with huge pages of this size: off, 2M, 1G (transparent huge pages if none are reserved)")->capture_default_str()->check(CLI::IsMember({"off", "2M", "1G"}));
+    capture_cmd->add_option("--io-backend", config.io_backend, "How capture files are written: buffered (writev through the page cache), stream (buffered, but written back and dropped from the page cache as it goes) or uring (io_uring with O_DIRECT)")->capture_default_str()->check(CLI::IsMember({"buffered", "stream", "uring"}));
+    capture_cmd->add_option("--io-depth", config.io_depth, "Writes in flight per file with --io-backend uring")->capture_default_str()->check(CLI::Range(1, 256));
+    capture_cmd->add_option("--io-block-size", config.io_block_size, "Size in KiB of the blocks writers stage entries in and write out with one call (rounded up to a multiple of 4)")->capture_default_str()->check(CLI::Range(4, 1 << 20));
+    capture_cmd->add_option("--dirty-limit", config.dirty_limit, "Page cache in MiB each file may hold dirty or under writeback with --io-backend stream")->capture_default_str()->check(CLI::Range(2, 1 << 16));
+    capture_cmd->add_option("--flush-timeout", config.flush_timeout, "Time in milliseconds after which a writer with no new entries writes out its partly filled block")->capture_default_str()->check(CLI::Range(0, 60000));
+    capture_cmd->add_option("--rotate-size", config.rotate_size, "Start a new segment of each file once it reaches this many MiB (0 disables)")->capture_default_str()->check(CLI::NonNegativeNumber);
+    capture_cmd->add_option("--rotate-interval", config.rotate_interval, "Start a new segment of each file after this many seconds (0 disables)")->capture_default_str()->check(CLI::NonNegativeNumber);
+    capture_cmd->add_option("--segment-count", config.segment_count, "Segments of each file to keep on disk when rotating, older ones are deleted (0 keeps all)")->capture_default_str()->check(CLI::NonNegativeNumber);
+    capture_cmd->add_flag("--lock-memory", config.lock_memory, "Lock capture buffers into RAM");
     capture_cmd->add_flag("-n,--nano", config.nano, "Record timestamps with nanosecond precision");
     capture_cmd->add_flag("-p,--promisc", config.promisc, "Enable promiscuous mode on the interface for capture");
     capture_cmd->add_flag("-m,--rfmon", config.rfmon, "Enable monitor mode on the interface for capture");
@@ -88,6 +154,9 @@ int fastcap(int argc, const char* const* argv) {
     auto build_cmd = app.add_subcommand("build", "Post-process fastcap capture files into a single PCAPNG capture file");
     build_cmd->add_option("pcapng", pcapng_out, "PCAPNG file to write")->required();
     build_cmd->add_option("captures", pcapng_in, "Fastcap capture files to process")->required()->check(CLI::ExistingFile);
+    auto start_id_opt = build_cmd->add_option("--start-id", start_id, "Skip entries before this entry ID");
+    build_cmd->add_option("--start-time", start_time, "Skip entries captured before this UNIX time in seconds")->check(CLI::NonNegativeNumber)->excludes(start_id_opt);
+    build_cmd->add_flag("--mmap", mmap_in, "Map uncompressed capture files into memory instead of reading them");
 
     build_cmd->excludes(capture_cmd);
     app.require_subcommand(1);
@@ -95,6 +164,8 @@ int fastcap(int argc, const char* const* argv) {
     CLI11_PARSE(app, argc, argv);
 
     config.bufsz <<= (20 - 1);
+    config.block_size <<= 10;
+    config.io_block_size = ((config.io_block_size + 3) & ~3) << 10;
 
     spdlog::init_thread_pool(8192, 1);
     auto lvl = spdlog::level::info;
@@ -128,7 +199,16 @@ int fastcap(int argc, const char* const* argv) {
         worker.join();
         return rc;
     } else if (app.got_subcommand(build_cmd)) {
-        write_pcapng(pcapng_out, pcapng_in);
+        ReaderSet readers{pcapng_in, mmap_in};
+        // files with a sidecar index are seeked into, the others are skipped through block by block
+        if (start_id > 0) {
+            readers.seek_id(start_id);
+        } else if (start_time >= 0.0) {
+            const auto secs = static_cast<uint64_t>(start_time);
+            const auto scale = readers.nanosecond_precision() ? 1e9 : 1e6;
+            readers.seek_time(secs, static_cast<uint64_t>((start_time - static_cast<double>(secs)) * scale));
+        }
+        write_pcapng(pcapng_out, readers);
         return 0;
     }
     spdlog::error("unknown command");
@@ -0,0 +1,177 @@
+#include <fastcap/memory.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <linux/memfd.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static size_t huge_page_size(const Config& config) {
+    if (config.huge_pages == "1G") {
+        return size_t{1} << 30;
+    }
+    if (config.huge_pages == "2M") {
+        return size_t{2} << 20;
+    }
+    return 0;
+}
+
+static int huge_page_flags(size_t page_size) {
+    // the page size is encoded as log2 in the bits above the hugetlb flag, for both mmap and memfd
+    return __builtin_ctzll(page_size) << MAP_HUGE_SHIFT;
+}
+
+static size_t round_up(size_t size, size_t page_size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+static bool prepare_buffer(void* mem, size_t size, const Config& config, bool huge, int node) {
+    if (node >= 0) {
+        // must happen before the memory is faulted in, preferred rather than bound so a full
+        // node doesn't fail the capture
+        unsigned long mask = 1ul << node;
+        if (node >= static_cast<int>(sizeof(mask) * 8)
+            || syscall(SYS_mbind, mem, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) != 0) {
+            spdlog::warn("failed to place buffer on NUMA node {}: {}", node, strerror(errno));
+        }
+    }
+    if (!huge && config.huge_pages != "off") {
+        // best effort, this fails quietly when transparent huge pages are disabled
+        madvise(mem, size, MADV_HUGEPAGE);
+    }
+    if (config.lock_memory) {
+        // mlock faults everything in as well
+        if (mlock(mem, size) != 0) {
+            spdlog::error("failed to lock {} bytes of memory: {}", size, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+    if (madvise(mem, size, MADV_POPULATE_WRITE) != 0) {
+        // kernels before 5.14 don't know MADV_POPULATE_WRITE
+        const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto bytes = reinterpret_cast<volatile uint8_t*>(mem);
+        for (size_t i = 0; i < size; i += page) {
+            bytes[i] = 0;
+        }
+    }
+    return true;
+}
+
+static void* map_mirrored(int fd, size_t size, size_t page_size) {
+    if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+        return nullptr;
+    }
+    // reserve the address range for both views first so nothing else can land in between,
+    // with room to align it to the page size
+    const auto reserved = 2 * size + page_size;
+    auto mem = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    auto reserved_begin = reinterpret_cast<uint8_t*>(mem);
+    auto base = reinterpret_cast<uint8_t*>(round_up(reinterpret_cast<size_t>(mem), page_size));
+    for (auto view : {base, base + size}) {
+        if (mmap(view, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            const auto err = errno;
+            munmap(mem, reserved);
+            errno = err;
+            return nullptr;
+        }
+    }
+    // give back the alignment slack on either side
+    if (base > reserved_begin) {
+        munmap(reserved_begin, static_cast<size_t>(base - reserved_begin));
+    }
+    auto tail = base + 2 * size;
+    if (reserved_begin + reserved > tail) {
+        munmap(tail, static_cast<size_t>(reserved_begin + reserved - tail));
+    }
+    return base;
+}
+
+static void* map_mirrored_fd(unsigned flags, size_t size, size_t page_size) {
+    auto fd = memfd_create("fastcap", MFD_CLOEXEC | flags);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto mem = map_mirrored(fd, size, page_size);
+    const auto err = errno;
+    // the mappings keep the memory alive
+    close(fd);
+    errno = err;
+    return mem;
+}
+
+void* map_buffer(size_t& size, const Config& config, int node) {
+    const auto huge = huge_page_size(config);
+    if (huge != 0) {
+        const auto huge_size = round_up(size, huge);
+        auto mem = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_page_flags(huge), -1, 0);
+        if (mem != MAP_FAILED) {
+            size = huge_size;
+            if (!prepare_buffer(mem, size, config, true, node)) {
+                munmap(mem, size);
+                return nullptr;
+            }
+            return mem;
+        }
+        spdlog::warn("no {} huge pages available, falling back to transparent huge pages: {}", config.huge_pages, strerror(errno));
+    }
+    size = round_up(size, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        spdlog::error("failed to allocate {} bytes: {}", size, strerror(errno));
+        return nullptr;
+    }
+    if (!prepare_buffer(mem, size, config, false, node)) {
+        munmap(mem, size);
+        return nullptr;
+    }
+    return mem;
+}
+
+void* map_mirrored_buffer(size_t& size, const Config& config, int node) {
+    const auto huge = huge_page_size(config);
+    if (huge != 0) {
+        const auto huge_size = round_up(size, huge);
+        auto mem = map_mirrored_fd(MFD_HUGETLB | static_cast<unsigned>(huge_page_flags(huge)), huge_size, huge);
+        if (mem != nullptr) {
+            size = huge_size;
+            if (!prepare_buffer(mem, 2 * size, config, true, node)) {
+                munmap(mem, 2 * size);
+                return nullptr;
+            }
+            return mem;
+        }
+        spdlog::warn("no {} huge pages available, falling back to transparent huge pages: {}", config.huge_pages, strerror(errno));
+    }
+    const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size = round_up(size, page);
+    auto mem = map_mirrored_fd(0, size, page);
+    if (mem == nullptr) {
+        spdlog::error("failed to allocate {} bytes: {}", size, strerror(errno));
+        return nullptr;
+    }
+    if (!prepare_buffer(mem, 2 * size, config, false, node)) {
+        munmap(mem, 2 * size);
+        return nullptr;
+    }
+    return mem;
+}
+
+void unmap_buffer(void* mem, size_t size) {
+    if (mem != nullptr) {
+        munmap(mem, size);
+    }
+}
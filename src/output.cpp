@@ -0,0 +1,519 @@
+#include <fastcap/output.hpp>
+#include <fastcap/block.hpp>
+#include <fastcap/memory.hpp>
+#include <fastcap/utils.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// O_DIRECT needs offsets and lengths aligned to the logical block size, 4 KiB covers all of them
+static constexpr size_t DIRECT_ALIGN = 4096;
+
+static bool write_all(int fd, iovec* iov, int count) {
+    while (count > 0) {
+        auto written = writev(fd, iov, std::min(count, IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        auto n = static_cast<size_t>(written);
+        while (count > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = reinterpret_cast<uint8_t*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static int io_uring_setup(unsigned entries, io_uring_params& params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+OutputFile::OutputFile(const std::string& path, const Config& config, int node) : path_(path) {
+    const bool uring = config.io_backend == "uring";
+    if (uring) {
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        if (fd_ >= 0) {
+            direct_ = true;
+        } else if (errno == EINVAL) {
+            spdlog::warn("{} does not support O_DIRECT, writing through the page cache", path);
+        }
+    }
+    if (fd_ < 0) {
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd_ < 0) {
+        spdlog::error("failed to open {}: {}", path, strerror(errno));
+        return;
+    }
+    // compressed blocks can't be seeked to, so those files go without an index
+    if (config.compression == "none") {
+        index_interval_ = static_cast<uint64_t>(config.index_interval) << 20;
+    }
+    if (config.io_backend == "stream") {
+        stream_chunk_ = (static_cast<uint64_t>(config.dirty_limit) << 20) / 2;
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    auto block_size = static_cast<size_t>(config.io_block_size);
+    if (config.compression != "none") {
+        // data is staged uncompressed in raw_, the blocks hold whole frames
+        compressor_ = std::make_unique<Compressor>(config.compression, config.compression_level);
+        raw_.resize(block_size);
+        block_size = (sizeof(FrameHdr) + compressor_->bound(block_size) + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+    }
+    if (!setup_blocks(config, node, uring ? static_cast<size_t>(config.io_depth) : 1, block_size)) {
+        failed_ = true;
+        return;
+    }
+    if (uring && !setup_uring(config)) {
+        spdlog::warn("io_uring is unavailable for {}, falling back to buffered writes", path);
+        if (direct_) {
+            // the buffered backend writes partial blocks, which O_DIRECT does not allow
+            fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+            direct_ = false;
+        }
+    }
+}
+
+OutputFile::~OutputFile() {
+    close();
+}
+
+bool OutputFile::setup_blocks(const Config& config, int node, size_t count, size_t block_size) {
+    block_size_ = block_size;
+    blocks_len_ = block_size_ * count;
+    blocks_ = reinterpret_cast<uint8_t*>(map_buffer(blocks_len_, config, node));
+    if (blocks_ == nullptr) {
+        return false;
+    }
+    block_lens_.assign(count, 0);
+    for (auto i = static_cast<uint32_t>(count); i > 0; --i) {
+        free_blocks_.push_back(i - 1);
+    }
+    return true;
+}
+
+bool OutputFile::setup_uring(const Config& config) {
+    const auto depth = static_cast<unsigned>(config.io_depth);
+    io_uring_params params{};
+    int ring_fd = io_uring_setup(depth, params);
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_len = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_len = params.cq_off.cqes + (params.cq_entries * sizeof(io_uring_cqe));
+    void* sqes = MAP_FAILED;
+    size_t sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+    auto guard = finally([&] {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_len);
+        }
+        if (cq_map != MAP_FAILED && cq_map != sq_map) {
+            munmap(cq_map, cq_map_len);
+        }
+        if (sq_map != MAP_FAILED) {
+            munmap(sq_map, sq_map_len);
+        }
+        if (ring_fd >= 0) {
+            ::close(ring_fd);
+        }
+    });
+
+    if (ring_fd < 0) {
+        spdlog::error("failed to create io_uring: {}", strerror(errno));
+        return false;
+    }
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        sq_map_len = std::max(sq_map_len, cq_map_len);
+        cq_map_len = sq_map_len;
+    }
+    sq_map = mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        spdlog::error("failed to map io_uring submission queue: {}", strerror(errno));
+        return false;
+    }
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        cq_map = sq_map;
+    } else {
+        cq_map = mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) {
+            spdlog::error("failed to map io_uring completion queue: {}", strerror(errno));
+            return false;
+        }
+    }
+    sqes = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        spdlog::error("failed to map io_uring submission entries: {}", strerror(errno));
+        return false;
+    }
+
+    // registered buffers save pinning the pages on every write, but need enough locked memory
+    std::vector<iovec> iov(depth);
+    for (unsigned i = 0; i < depth; ++i) {
+        iov[i].iov_base = blocks_ + (i * block_size_);
+        iov[i].iov_len = block_size_;
+    }
+    fixed_buffers_ = io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iov.data(), depth) == 0;
+    if (!fixed_buffers_) {
+        spdlog::debug("failed to register io_uring buffers: {}", strerror(errno));
+    }
+
+    auto sq = reinterpret_cast<uint8_t*>(sq_map);
+    auto cq = reinterpret_cast<uint8_t*>(cq_map);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    std::swap(ring_fd_, ring_fd);
+    std::swap(sq_map_, sq_map);
+    std::swap(sq_map_len_, sq_map_len);
+    std::swap(cq_map_, cq_map);
+    std::swap(cq_map_len_, cq_map_len);
+    sqes_ = reinterpret_cast<io_uring_sqe*>(sqes);
+    sqes = MAP_FAILED;
+    sqes_len_ = sqes_len;
+    sq_map = MAP_FAILED;
+    cq_map = MAP_FAILED;
+    return true;
+}
+
+bool OutputFile::ok() const {
+    return fd_ >= 0 && !failed_;
+}
+
+uint64_t OutputFile::size() const {
+    return size_;
+}
+
+void OutputFile::preallocate(uint64_t len) {
+    if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(len)) != 0) {
+        spdlog::debug("failed to preallocate capture file: {}", strerror(errno));
+    }
+}
+
+void OutputFile::submit(uint32_t block, uint32_t len) {
+    if (ring_fd_ < 0) {
+        iovec iov{blocks_ + (block * block_size_), len};
+        if (!write_all(fd_, &iov, 1)) {
+            spdlog::error("failed to write capture file: {}", strerror(errno));
+            failed_ = true;
+        }
+        offset_ += len;
+        free_blocks_.push_back(block);
+        if (stream_chunk_ > 0) {
+            stream_writeback();
+        }
+        return;
+    }
+
+    // every block has its own submission entry, so there is always one free
+    const auto tail = *sq_tail_;
+    const auto idx = tail & *sq_mask_;
+    auto& sqe = sqes_[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = fixed_buffers_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe.fd = fd_;
+    sqe.addr = reinterpret_cast<uint64_t>(blocks_ + (block * block_size_));
+    sqe.len = len;
+    sqe.off = offset_;
+    sqe.buf_index = static_cast<uint16_t>(block);
+    sqe.user_data = block;
+    sq_array_[idx] = idx;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    block_lens_[block] = len;
+    offset_ += len;
+    ++in_flight_;
+    while (io_uring_enter(ring_fd_, 1, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN) {
+            spdlog::error("failed to submit write: {}", strerror(errno));
+            failed_ = true;
+            break;
+        }
+    }
+}
+
+void OutputFile::stream_writeback() {
+    if (offset_ - synced_ < stream_chunk_) {
+        return;
+    }
+    // start writing back the latest chunk without waiting for it
+    const auto prev = synced_;
+    if (sync_file_range(fd_, static_cast<off_t>(synced_), static_cast<off_t>(offset_ - synced_), SYNC_FILE_RANGE_WRITE) != 0) {
+        spdlog::debug("failed to start writeback of capture file: {}", strerror(errno));
+    }
+    synced_ = offset_;
+
+    // the chunk before it has had a whole chunk's worth of writes to finish, wait for whatever
+    // is left of it and drop it, only whole pages can be dropped so a partial one is kept
+    const auto end = prev & ~(DIRECT_ALIGN - 1);
+    if (end <= dropped_) {
+        return;
+    }
+    const auto start = static_cast<off_t>(dropped_);
+    const auto len = static_cast<off_t>(end - dropped_);
+    if (sync_file_range(fd_, start, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+        spdlog::debug("failed to wait for writeback of capture file: {}", strerror(errno));
+    }
+    posix_fadvise(fd_, start, len, POSIX_FADV_DONTNEED);
+    dropped_ = end;
+}
+
+void OutputFile::reap(bool wait) {
+    auto head = *cq_head_;
+    if (wait && head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        if (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            spdlog::error("failed to wait for writes: {}", strerror(errno));
+            failed_ = true;
+            return;
+        }
+    }
+    const auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const auto& cqe = cqes_[head & *cq_mask_];
+        const auto block = static_cast<uint32_t>(cqe.user_data);
+        if (cqe.res < 0) {
+            spdlog::error("failed to write capture file: {}", strerror(-cqe.res));
+            failed_ = true;
+        } else if (static_cast<uint32_t>(cqe.res) != block_lens_[block]) {
+            spdlog::error("short write to capture file: {} of {} bytes", cqe.res, block_lens_[block]);
+            failed_ = true;
+        }
+        free_blocks_.push_back(block);
+        --in_flight_;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+bool OutputFile::acquire() {
+    while (free_blocks_.empty() && !failed_) {
+        reap(true);
+    }
+    if (failed_) {
+        return false;
+    }
+    cur_block_ = free_blocks_.back();
+    free_blocks_.pop_back();
+    fill_ = 0;
+    flushed_ = 0;
+    return true;
+}
+
+void OutputFile::write_frame() {
+    if (!acquire()) {
+        return;
+    }
+    const auto block = static_cast<uint32_t>(cur_block_);
+    auto data = blocks_ + (block * block_size_);
+    cur_block_ = -1;
+
+    FrameHdr hdr{};
+    hdr.magic = FRAME_MAGIC;
+    hdr.codec = static_cast<uint8_t>(compressor_->codec());
+    hdr.raw_len = static_cast<uint32_t>(raw_fill_);
+    auto len = compressor_->compress(raw_.data(), raw_fill_, data + sizeof(hdr), block_size_ - sizeof(hdr));
+    if (len == 0) {
+        hdr.codec = static_cast<uint8_t>(Codec::none);
+        std::memcpy(data + sizeof(hdr), raw_.data(), raw_fill_);
+        len = raw_fill_;
+    }
+    hdr.data_len = static_cast<uint32_t>(len);
+    len += sizeof(hdr);
+    if (direct_) {
+        // frames are padded out to whole pages rather than rewriting a partial one
+        const auto padded = (len + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+        std::memset(data + len, 0, padded - len);
+        len = padded;
+    }
+    hdr.frame_len = static_cast<uint32_t>(len);
+    std::memcpy(data, &hdr, sizeof(hdr));
+    size_ += len;
+    raw_fill_ = 0;
+    submit(block, static_cast<uint32_t>(len));
+}
+
+void OutputFile::checkpoint(uint64_t first_id, uint64_t first_ts) {
+    if (index_interval_ == 0 || size_ < next_checkpoint_) {
+        return;
+    }
+    if (index_fd_ < 0) {
+        const auto path = index_path(path_);
+        index_fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (index_fd_ < 0 || ::write(index_fd_, &INDEX_MAGIC, sizeof(INDEX_MAGIC)) != sizeof(INDEX_MAGIC)) {
+            spdlog::warn("failed to write index {}, capture continues without it: {}", path, strerror(errno));
+            index_interval_ = 0;
+            return;
+        }
+    }
+    const IndexEntry entry{size_, first_id, first_ts};
+    if (::write(index_fd_, &entry, sizeof(entry)) != sizeof(entry)) {
+        spdlog::warn("failed to write index of {}, capture continues without it: {}", path_, strerror(errno));
+        index_interval_ = 0;
+        return;
+    }
+    next_checkpoint_ = size_ + index_interval_;
+}
+
+bool OutputFile::write(const iovec* iov, size_t count) {
+    if (!ok()) {
+        return false;
+    }
+    if (compressor_ != nullptr) {
+        for (size_t i = 0; i < count; ++i) {
+            auto src = reinterpret_cast<const uint8_t*>(iov[i].iov_base);
+            auto len = iov[i].iov_len;
+            while (len > 0) {
+                const auto n = std::min(len, raw_.size() - raw_fill_);
+                std::memcpy(raw_.data() + raw_fill_, src, n);
+                raw_fill_ += n;
+                src += n;
+                len -= n;
+                if (raw_fill_ == raw_.size()) {
+                    write_frame();
+                }
+            }
+        }
+        if (ring_fd_ >= 0) {
+            reap(false);
+        }
+        return !failed_;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        auto src = reinterpret_cast<const uint8_t*>(iov[i].iov_base);
+        auto len = iov[i].iov_len;
+        while (len > 0) {
+            if (cur_block_ < 0 && !acquire()) {
+                return false;
+            }
+            const auto n = std::min(len, block_size_ - fill_);
+            std::memcpy(blocks_ + (static_cast<size_t>(cur_block_) * block_size_) + fill_, src, n);
+            fill_ += n;
+            size_ += n;
+            src += n;
+            len -= n;
+            if (fill_ == block_size_) {
+                submit(static_cast<uint32_t>(cur_block_), static_cast<uint32_t>(block_size_));
+                cur_block_ = -1;
+            }
+        }
+    }
+    if (ring_fd_ >= 0) {
+        // pick up completions as we go so blocks are back before they are needed
+        reap(false);
+    }
+    return !failed_;
+}
+
+bool OutputFile::pending() const {
+    if (compressor_ != nullptr) {
+        return raw_fill_ > 0;
+    }
+    return cur_block_ >= 0 && fill_ > flushed_;
+}
+
+void OutputFile::flush() {
+    if (!pending() || failed_) {
+        return;
+    }
+    if (compressor_ != nullptr) {
+        write_frame();
+        return;
+    }
+    const auto block = static_cast<uint32_t>(cur_block_);
+    auto data = blocks_ + (block * block_size_);
+    cur_block_ = -1;
+    if (!direct_) {
+        submit(block, static_cast<uint32_t>(fill_));
+        return;
+    }
+
+    // O_DIRECT only writes whole pages, so the tail goes out zero padded and is written again,
+    // together with whatever follows it, from the start of the next block
+    const auto aligned = fill_ & ~(DIRECT_ALIGN - 1);
+    const auto tail = fill_ - aligned;
+    const auto len = (fill_ + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+    std::memset(data + fill_, 0, len - fill_);
+    submit(block, static_cast<uint32_t>(len));
+    offset_ -= len - aligned;
+    if (tail == 0) {
+        return;
+    }
+    // the rewrite must not race the padded write of the same page
+    while (in_flight_ > 0 && !failed_) {
+        reap(true);
+    }
+    if (!acquire()) {
+        return;
+    }
+    std::memmove(blocks_ + (static_cast<size_t>(cur_block_) * block_size_), data + aligned, tail);
+    fill_ = tail;
+    flushed_ = tail;
+}
+
+void OutputFile::close() {
+    if (fd_ < 0) {
+        return;
+    }
+    flush();
+    cur_block_ = -1;
+    while (in_flight_ > 0 && !failed_) {
+        reap(true);
+    }
+    // an O_DIRECT flush leaves the padding of the last page behind
+    if (offset_ != size_ && ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+        spdlog::error("failed to truncate capture file: {}", strerror(errno));
+    }
+    if (stream_chunk_ > 0 && offset_ > dropped_) {
+        // what is still cached of the file goes too, once it is written back
+        const auto start = static_cast<off_t>(dropped_);
+        sync_file_range(fd_, start, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd_, start, 0, POSIX_FADV_DONTNEED);
+    }
+    if (ring_fd_ >= 0) {
+        munmap(sqes_, sqes_len_);
+        if (cq_map_ != sq_map_) {
+            munmap(cq_map_, cq_map_len_);
+        }
+        munmap(sq_map_, sq_map_len_);
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+    }
+    if (blocks_ != nullptr) {
+        unmap_buffer(blocks_, blocks_len_);
+        blocks_ = nullptr;
+    }
+    if (index_fd_ >= 0) {
+        ::close(index_fd_);
+        index_fd_ = -1;
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
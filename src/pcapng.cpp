@@ -1,6 +1,10 @@
 #include <fastcap/pcapng.hpp>
 #include <spdlog/spdlog.h>
 
+#include <array>
+#include <cstring>
+#include <string_view>
+
 static std::array<uint8_t, 4> PADDING = {0, 0, 0, 0};
 
 void PcapNGWriter::write(const void* buf, std::streamsize len) {
@@ -8,204 +12,96 @@ void PcapNGWriter::write(const void* buf, std::streamsize len) {
 }
 
 template <typename T>
-void PcapNGWriter::write(const T* buf) {
-    write(buf, sizeof(T));
-}
-
-std::streamoff PcapNGWriter::position() {
-    return file_.tellp();
+T padding(T len) {
+    return (4 - (len % 4)) % 4;
 }
 
-void PcapNGWriter::seek(std::streamoff pos) {
-    file_.seekp(pos);
+static void append(std::vector<uint8_t>& out, const void* data, size_t len) {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + len);
 }
 
 template <typename T>
-T padding(T len) {
-    return (4 - (len % 4)) % 4;
+static void append(std::vector<uint8_t>& out, const T& value) {
+    append(out, &value, sizeof(T));
 }
 
-void PcapNGWriter::write_shb() {
-    const uint32_t shb_id = 0x0A0D0D0A;
-    const uint32_t magic = 0x1A2B3C4D;
-    const uint16_t major = 1;
-    const uint16_t minor = 0;
-    const uint64_t section_len = 0xFFFFFFFFFFFFFFFF;
-    uint32_t block_len = 0;
-    write(&shb_id);
-    auto block_len_pos = position();
-    write(&block_len);
-    write(&magic);
-    write(&major);
-    write(&minor);
-    write(&section_len);
-    
-    uint16_t opt_id = 2;
-    uint16_t opt_len = static_cast<uint16_t>(readers_->cpu_model().size());
-    auto padding_len = padding(opt_len);
-    write(&opt_id);
-    write(&opt_len);
-    write(readers_->cpu_model().c_str(), readers_->cpu_model().size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
-    }
+static void append_option(std::vector<uint8_t>& out, uint16_t opt_id, const void* data, size_t len) {
+    auto opt_len = static_cast<uint16_t>(len);
+    append(out, opt_id);
+    append(out, opt_len);
+    append(out, data, len);
+    append(out, PADDING.data(), padding(len));
+}
 
-    opt_id = 3;
-    opt_len = static_cast<uint16_t>(readers_->os_version().size());
-    padding_len = padding(opt_len);
-    write(&opt_id);
-    write(&opt_len);
-    write(readers_->os_version().c_str(), readers_->os_version().size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
-    }
+// fills in the block length at start and after the block
+static void finish_block(std::vector<uint8_t>& out, size_t start) {
+    auto block_len = static_cast<uint32_t>(out.size() - start + 4);
+    std::memcpy(out.data() + start + 4, &block_len, sizeof(block_len));
+    append(out, block_len);
+}
 
+void append_shb(std::vector<uint8_t>& out, const PcapNGInfo& info) {
+    const auto start = out.size();
+    append(out, uint32_t{0x0A0D0D0A});
+    append(out, uint32_t{0});
+    append(out, uint32_t{0x1A2B3C4D});
+    append(out, uint16_t{1});
+    append(out, uint16_t{0});
+    append(out, uint64_t{0xFFFFFFFFFFFFFFFF});
+
+    append_option(out, 2, info.cpu_model.data(), info.cpu_model.size());
+    append_option(out, 3, info.os_version.data(), info.os_version.size());
     const std::string_view app_name = "Fastcap";
-    opt_id = 4;
-    opt_len = static_cast<uint16_t>(app_name.size());
-    padding_len = padding(opt_len);
-    write(&opt_id);
-    write(&opt_len);
-    write(app_name.data(), app_name.size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
-    }
-
-    opt_id = 0;
-    opt_len = 0;
-    write(&opt_id);
-    write(&opt_len);
-    auto tmp = position();
-    block_len = (tmp - block_len_pos) + 8;
-    seek(block_len_pos);
-    write(&block_len);
-    seek(tmp);
-    write(&block_len);
+    append_option(out, 4, app_name.data(), app_name.size());
+    append_option(out, 0, nullptr, 0);
+    finish_block(out, start);
 }
 
-void PcapNGWriter::write_idb() {
-    const uint32_t idb_id = 1;
-    uint32_t block_len = 0;
-    uint16_t link = readers_->link();
-    uint16_t reserved = 0;
-    auto snaplen = static_cast<uint32_t>(readers_->snaplen());
-    write(&idb_id);
-    auto block_len_pos = position();
-    write(&block_len);
-    write(&link);
-    write(&reserved);
-    write(&snaplen);
-
-    uint16_t opt_id = 2;
-    uint16_t opt_len = static_cast<uint16_t>(readers_->device_name().size());
-    uint16_t padding_len = padding(opt_len);
-    write(&opt_id);
-    write(&opt_len);
-    write(readers_->device_name().c_str(), readers_->device_name().size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
+void append_idb(std::vector<uint8_t>& out, const PcapNGInfo& info) {
+    const auto start = out.size();
+    append(out, uint32_t{1});
+    append(out, uint32_t{0});
+    append(out, info.link);
+    append(out, uint16_t{0});
+    append(out, static_cast<uint32_t>(info.snaplen));
+
+    append_option(out, 2, info.dev_name.data(), info.dev_name.size());
+    for (const auto& ipv4 : info.ipv4s) {
+        std::array<uint8_t, 8> opt;
+        std::memcpy(opt.data(), ipv4.addr.data(), 4);
+        std::memcpy(opt.data() + 4, ipv4.mask.data(), 4);
+        append_option(out, 4, opt.data(), opt.size());
     }
-
-    opt_id = 4;
-    opt_len = 8;
-    for (const auto& ipv4 : readers_->ipv4s()) {
-        write(&opt_id);
-        write(&opt_len);
-        write(ipv4.addr.data(), 4);
-        write(ipv4.mask.data(), 4);
+    for (const auto& ipv6 : info.ipv6s) {
+        std::array<uint8_t, 17> opt;
+        std::memcpy(opt.data(), ipv6.addr.data(), 16);
+        opt[16] = ipv6.prefix_len;
+        append_option(out, 5, opt.data(), opt.size());
     }
-
-    opt_id = 5;
-    opt_len = 17;
-    for (const auto& ipv6 : readers_->ipv6s()) {
-        write(&opt_id);
-        write(&opt_len);
-        write(ipv6.addr.data(), 16);
-        write(&ipv6.prefix_len);
-        write(PADDING.data(), 3);
+    if (info.mac.has_value()) {
+        append_option(out, 6, info.mac->data(), 6);
     }
-
-    if (readers_->mac().has_value()) {
-        opt_id = 6;
-        opt_len = 6;
-        write(&opt_id);
-        write(&opt_len);
-        write(readers_->mac()->data(), 6);
-        write(PADDING.data(), 2);
+    append_option(out, 8, &info.speed, sizeof(info.speed));
+    const uint8_t tsresol = info.nano ? 9 : 6;
+    append_option(out, 9, &tsresol, 1);
+    if (!info.filter.empty()) {
+        std::vector<uint8_t> opt{0};
+        append(opt, info.filter.data(), info.filter.size());
+        append_option(out, 11, opt.data(), opt.size());
     }
-
-    opt_id = 8;
-    opt_len = 8;
-    auto speed = readers_->speed();
-    write(&opt_id);
-    write(&opt_len);
-    write(&speed);
-
-    opt_id = 9;
-    opt_len = 1;
-    uint8_t tsresol = readers_->nanosecond_precision() ? 9 : 6;
-    write(&opt_id);
-    write(&opt_len);
-    write(&tsresol);
-    write(PADDING.data(), 3);
-
-    if (!readers_->capture_filter().empty()) {
-        opt_id = 11;
-        opt_len = static_cast<uint16_t>(readers_->capture_filter().size() + 1);
-        uint8_t prefix = 0;
-        padding_len = padding(opt_len);
-        write(&opt_id);
-        write(&opt_len);
-        write(&prefix);
-        write(readers_->capture_filter().c_str(), readers_->capture_filter().size());
-        if (padding_len != 0) {
-            write(PADDING.data(), padding_len);
-        }
+    append_option(out, 12, info.os_version.data(), info.os_version.size());
+    if (info.start_sec != 0) {
+        append_option(out, 14, &info.start_sec, sizeof(info.start_sec));
     }
-
-    opt_id = 12;
-    opt_len = static_cast<uint16_t>(readers_->os_version().size());
-    padding_len = padding(opt_len);
-    write(&opt_id);
-    write(&opt_len);
-    write(readers_->os_version().c_str(), readers_->os_version().size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
-    }
-
-    opt_id = 14;
-    opt_len = 8;
-    auto tsoffset = readers_->start_seconds();
-    write(&opt_id);
-    write(&opt_len);
-    write(&tsoffset);
-
-    opt_id = 15;
-    opt_len = static_cast<uint16_t>(readers_->hardware().size());
-    padding_len = padding(opt_len);
-    write(&opt_id);
-    write(&opt_len);
-    write(readers_->hardware().c_str(), readers_->hardware().size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
-    }
-
-    opt_id = 0;
-    opt_len = 0;
-    write(&opt_id);
-    write(&opt_len);
-
-    auto tmp = position();
-    block_len = static_cast<uint32_t>(tmp - block_len_pos) + 8;
-    seek(block_len_pos);
-    write(&block_len);
-    seek(tmp);
-    write(&block_len);
+    append_option(out, 15, info.hardware.data(), info.hardware.size());
+    append_option(out, 0, nullptr, 0);
+    finish_block(out, start);
 }
 
-std::pair<uint32_t, uint32_t> PcapNGWriter::timestamp(uint64_t sec, uint64_t frac) {
-    sec -= readers_->start_seconds();
-    if (readers_->nanosecond_precision()) {
+static std::pair<uint32_t, uint32_t> timestamp(const PcapNGInfo& info, uint64_t sec, uint64_t frac) {
+    sec -= info.start_sec;
+    if (info.nano) {
         sec *= 1'000'000'000;
     } else {
         sec *= 1'000'000;
@@ -216,88 +112,102 @@ std::pair<uint32_t, uint32_t> PcapNGWriter::timestamp(uint64_t sec, uint64_t fra
     return {hi, lo};
 }
 
-void PcapNGWriter::write_epb(const PktHdr& hdr, const std::vector<uint8_t>& data) {
-    const uint32_t epb_id = 6;
-    const uint32_t iface_id = 0;
-    auto [ts_hi, ts_lo] = timestamp(hdr.secs, hdr.frac);
-    auto caplen = hdr.caplen;
-    auto origlen = hdr.len;
-    auto padding_len = padding(data.size());
-    uint32_t block_len = static_cast<uint32_t>(32 + data.size() + padding_len);
+void encode_epb_header(uint8_t* out, const PcapNGInfo& info, uint64_t secs, uint64_t frac, uint32_t len, uint32_t caplen) {
+    auto [ts_hi, ts_lo] = timestamp(info, secs, frac);
+    const uint32_t fields[7] = {
+        6,
+        static_cast<uint32_t>(32 + caplen + padding(caplen)),
+        0,
+        ts_hi,
+        ts_lo,
+        caplen,
+        len
+    };
+    std::memcpy(out, fields, EPB_HEADER_LEN);
+}
+
+size_t encode_epb_trailer(uint8_t* out, uint32_t caplen) {
+    const auto padding_len = padding(caplen);
+    const auto block_len = static_cast<uint32_t>(32 + caplen + padding_len);
+    std::memset(out, 0, padding_len);
+    std::memcpy(out + padding_len, &block_len, sizeof(block_len));
+    return padding_len + sizeof(block_len);
+}
 
-    write(&epb_id);
-    write(&block_len);
-    write(&iface_id);
-    write(&ts_hi);
-    write(&ts_lo);
-    write(&caplen);
-    write(&origlen);
-    write(data.data(), data.size());
-    if (padding_len != 0) {
-        write(PADDING.data(), padding_len);
+void encode_isb(uint8_t* out, const PcapNGInfo& info, const StatHdr& hdr) {
+    auto [ts_hi, ts_lo] = timestamp(info, hdr.secs, hdr.frac);
+    const uint32_t head[5] = {5, static_cast<uint32_t>(ISB_LEN), 0, ts_hi, ts_lo};
+    std::memcpy(out, head, sizeof(head));
+    out += sizeof(head);
+    // packets suppressed as duplicates or dropped on a full ring only show up as ones not
+    // delivered to the user
+    const auto dropped = hdr.os_drops + hdr.suppressed + hdr.queue_drops;
+    const auto delivered = hdr.recv > dropped ? hdr.recv - dropped : 0;
+    const std::pair<uint16_t, uint64_t> opts[4] = {{4, hdr.recv}, {5, hdr.iface_drops}, {7, hdr.os_drops}, {8, delivered}};
+    for (const auto& [opt_id, value] : opts) {
+        const uint16_t opt_len = 8;
+        std::memcpy(out, &opt_id, 2);
+        std::memcpy(out + 2, &opt_len, 2);
+        std::memcpy(out + 4, &value, 8);
+        out += 12;
     }
-    write(&block_len);
+    std::memset(out, 0, 4);
+    std::memcpy(out + 4, &head[1], 4);
+}
+
+void PcapNGWriter::write_epb(const PktHdr& hdr, const ByteSpan& data) {
+    uint8_t header[EPB_HEADER_LEN];
+    uint8_t trailer[EPB_TRAILER_MAX_LEN];
+    encode_epb_header(header, info_, hdr.secs, hdr.frac, hdr.len, static_cast<uint32_t>(data.size));
+    write(header, EPB_HEADER_LEN);
+    write(data.data, static_cast<std::streamsize>(data.size));
+    write(trailer, encode_epb_trailer(trailer, static_cast<uint32_t>(data.size)));
 
     ++pkt_count_;
 }
 
 void PcapNGWriter::write_isb(const StatHdr& hdr) {
-    const uint32_t isb_id = 5;
-    const uint32_t block_len = 64;
-    const uint32_t iface_id = 0;
-    auto [ts_hi, ts_lo] = timestamp(hdr.secs, hdr.frac);
-
-    write(&isb_id);
-    write(&block_len);
-    write(&iface_id);
-    write(&ts_hi);
-    write(&ts_lo);
-    
-    uint16_t opt_id = 4;
-    uint16_t opt_len = 8;
-    write(&opt_id);
-    write(&opt_len);
-    write(&hdr.recv);
-    
-    opt_id = 5;
-    opt_len = 8;
-    write(&opt_id);
-    write(&opt_len);
-    write(&hdr.iface_drops);
-    
-    opt_id = 7;
-    opt_len = 8;
-    write(&opt_id);
-    write(&opt_len);
-    write(&hdr.os_drops);
-
-    opt_id = 0;
-    opt_len = 0;
-    write(&opt_id);
-    write(&opt_len);
-
-    write(&block_len);
+    uint8_t block[ISB_LEN];
+    encode_isb(block, info_, hdr);
+    write(block, ISB_LEN);
 }
 
 PcapNGWriter::PcapNGWriter(const std::string& filepath, ReaderSet& readers)
-    : file_(filepath), readers_(&readers) {}
+    : file_(filepath), readers_(&readers) {
+    info_.cpu_model = readers.cpu_model();
+    info_.os_version = readers.os_version();
+    info_.dev_name = readers.device_name();
+    info_.nano = readers.nanosecond_precision();
+    info_.filter = readers.capture_filter();
+    info_.snaplen = readers.snaplen();
+    info_.ipv4s = readers.ipv4s();
+    info_.ipv6s = readers.ipv6s();
+    info_.mac = readers.mac();
+    info_.hardware = readers.hardware();
+    info_.speed = readers.speed();
+    info_.link = readers.link();
+    info_.start_sec = readers.start_seconds();
+}
 
 void PcapNGWriter::write_all() {
     const auto ONE_SEC = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::seconds(1));
     auto timer_end = std::chrono::high_resolution_clock::now() + ONE_SEC;
-    write_shb();
-    write_idb();
     std::vector<uint8_t> data;
+    append_shb(data, info_);
+    append_idb(data, info_);
+    write(data.data(), static_cast<std::streamsize>(data.size()));
     bool just_logged = false;
+    // packets are written from wherever the readers hold them
+    ByteSpan pkt{};
     for (;;) {
-        auto entry = readers_->next(data);
+        auto entry = readers_->next(pkt);
         if (!entry.has_value()) {
             break;
         }
-        std::visit([this, &data](const auto& hdr) {
+        std::visit([this, &pkt](const auto& hdr) {
             using hdr_t = std::decay_t<decltype(hdr)>;
             if constexpr (std::is_same_v<hdr_t, PktHdr>) {
-                write_epb(hdr, data);
+                write_epb(hdr, pkt);
             } else {
                 write_isb(hdr);
             }
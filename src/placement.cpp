@@ -0,0 +1,96 @@
+#include <fastcap/placement.hpp>
+#include <fastcap/sysinfo.hpp>
+
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/ranges.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstring>
+
+int Placement::cpu(const std::vector<int>& cpus, size_t idx) {
+    if (cpus.empty()) {
+        return -1;
+    }
+    return cpus[idx % cpus.size()];
+}
+
+static bool explicit_cpus(const std::string& list, const char* what, std::vector<int>& cpus) {
+    if (list.empty()) {
+        return true;
+    }
+    cpus = parse_cpu_list(list);
+    auto online = node_cpus(-1);
+    for (auto cpu : cpus) {
+        if (std::find(online.begin(), online.end(), cpu) == online.end()) {
+            spdlog::error("CPU {} in the {} CPU list is not online", cpu, what);
+            return false;
+        }
+    }
+    if (cpus.empty()) {
+        spdlog::error("invalid {} CPU list: {}", what, list);
+        return false;
+    }
+    return true;
+}
+
+bool plan_placement(const Config& config, Placement& placement) {
+    placement = Placement{};
+    if (!explicit_cpus(config.capture_cpus, "capture", placement.capture_cpus)
+        || !explicit_cpus(config.writer_cpus, "writer", placement.writer_cpus)) {
+        return false;
+    }
+
+    placement.node = iface_numa_node(config.iface);
+    if (placement.node < 0) {
+        spdlog::debug("interface {} has no NUMA node, leaving unspecified threads unpinned", config.iface);
+        return true;
+    }
+    spdlog::info("interface {} is on NUMA node {}", config.iface, placement.node);
+
+    // one thread per physical core before doubling up on hyperthreads
+    auto cpus = node_cpus(placement.node);
+    std::stable_partition(cpus.begin(), cpus.end(), cpu_is_primary_thread);
+    if (cpus.empty()) {
+        return true;
+    }
+
+    size_t next = 0;
+    if (placement.capture_cpus.empty()) {
+        for (int i = 0; i < config.capture_threads; ++i) {
+            placement.capture_cpus.push_back(cpus[next++ % cpus.size()]);
+        }
+    }
+    if (placement.writer_cpus.empty()) {
+        std::vector<int> rest;
+        for (auto cpu : cpus) {
+            if (std::find(placement.capture_cpus.begin(), placement.capture_cpus.end(), cpu) == placement.capture_cpus.end()) {
+                rest.push_back(cpu);
+            }
+        }
+        // with nothing left over, writers share the node with the capture threads
+        if (rest.empty()) {
+            rest = cpus;
+        }
+        for (int i = 0; i < config.num_files; ++i) {
+            placement.writer_cpus.push_back(rest[static_cast<size_t>(i) % rest.size()]);
+        }
+    }
+    spdlog::debug("capture CPUs: {}, writer CPUs: {}", fmt::join(placement.capture_cpus, ","), fmt::join(placement.writer_cpus, ","));
+    return true;
+}
+
+void pin_thread(int cpu) {
+    if (cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    auto rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        spdlog::warn("failed to pin thread to CPU {}: {}", cpu, strerror(rc));
+    }
+}
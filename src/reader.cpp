@@ -1,14 +1,220 @@
 #include <fastcap/reader.hpp>
+#include <fastcap/compress.hpp>
 #include <fastcap/utils.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(offsetof(StatHdr, suppressed) == STAT_V1_LEN);
+
+// Stream of the plain fastcap bytes in a compressed file. The next few frames are decompressed
+// in parallel on other threads while the current one is parsed, so a frame that is slow to decode
+// doesn't hold up the reader as long as the ones after it are quicker. A little of the previous
+// frame is kept in front of the current one, so the short seeks back Reader does keep working.
+class FrameBuf : public std::streambuf {
+  private:
+    static constexpr size_t KEEP = 64;
+    // frames being decompressed ahead of the current one
+    static constexpr size_t DEPTH = 4;
+
+    std::ifstream file_;
+    bool swapped_;
+    std::vector<char> buf_;
+    // stream position of the start of buf_
+    uint64_t base_{0};
+    std::deque<std::future<std::vector<char>>> next_;
+    // cleared at the end of the file or its first bad frame
+    bool more_{true};
+
+    void read_ahead() {
+        while (more_ && next_.size() < DEPTH) {
+            more_ = read_frame();
+        }
+    }
+
+    bool read_frame() {
+        FrameHdr hdr{};
+        file_.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+        if (!file_) {
+            return false;
+        }
+        if (hdr.magic != FRAME_MAGIC && hdr.magic != FRAME_MAGIC_SWAPPED) {
+            spdlog::error("corrupt frame in compressed capture file");
+            return false;
+        }
+        if (swapped_) {
+            hdr.raw_len = byteswap(hdr.raw_len);
+            hdr.data_len = byteswap(hdr.data_len);
+            hdr.frame_len = byteswap(hdr.frame_len);
+        }
+        std::vector<uint8_t> data(hdr.data_len);
+        file_.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        file_.seekg(static_cast<std::streamoff>(hdr.frame_len - sizeof(hdr) - hdr.data_len), std::ios::cur);
+        if (!file_) {
+            spdlog::error("truncated frame in compressed capture file");
+            return false;
+        }
+        next_.push_back(std::async(std::launch::async, [hdr, data = std::move(data)] {
+            std::vector<char> raw(hdr.raw_len);
+            if (!decompress(static_cast<Codec>(hdr.codec), data.data(), data.size(), reinterpret_cast<uint8_t*>(raw.data()), raw.size())) {
+                spdlog::error("failed to decompress frame in capture file");
+                raw.clear();
+            }
+            return raw;
+        }));
+        return true;
+    }
+
+  protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (next_.empty()) {
+            return traits_type::eof();
+        }
+        auto raw = next_.front().get();
+        next_.pop_front();
+        read_ahead();
+        if (raw.empty()) {
+            return traits_type::eof();
+        }
+        const auto keep = std::min(KEEP, buf_.size());
+        base_ += buf_.size() - keep;
+        buf_.erase(buf_.begin(), buf_.end() - static_cast<std::ptrdiff_t>(keep));
+        buf_.insert(buf_.end(), raw.begin(), raw.end());
+        setg(buf_.data(), buf_.data() + keep, buf_.data() + buf_.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+    pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode which) override {
+        if (dir == std::ios::cur) {
+            return seekpos(static_cast<off_type>(base_ + static_cast<uint64_t>(gptr() - eback())) + off, which);
+        } else if (dir == std::ios::beg) {
+            return seekpos(off, which);
+        }
+        return pos_type(off_type(-1));
+    }
+
+    pos_type seekpos(pos_type pos, std::ios::openmode) override {
+        const auto target = static_cast<uint64_t>(static_cast<off_type>(pos));
+        if (target < base_) {
+            return pos_type(off_type(-1));
+        }
+        while (target > base_ + buf_.size()) {
+            setg(eback(), egptr(), egptr());
+            if (underflow() == traits_type::eof()) {
+                return pos_type(off_type(-1));
+            }
+        }
+        setg(eback(), eback() + (target - base_), egptr());
+        return pos;
+    }
+
+  public:
+    FrameBuf(std::ifstream&& file, bool swapped) : file_(std::move(file)), swapped_(swapped) {
+        read_ahead();
+    }
+};
+
+// Stream over a whole uncompressed file mapped into memory. Reader parses headers through the
+// stream as usual, but takes payloads and v2 blocks straight from cur() and seeks past them, so
+// they are never copied. The mapping lives as long as the Reader.
+class MappedBuf : public std::streambuf {
+  private:
+    char* data_{nullptr};
+    size_t size_{0};
+
+  protected:
+    pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode which) override {
+        if (dir == std::ios::cur) {
+            return seekpos(static_cast<off_type>(gptr() - eback()) + off, which);
+        } else if (dir == std::ios::beg) {
+            return seekpos(off, which);
+        } else if (dir == std::ios::end) {
+            return seekpos(static_cast<off_type>(size_) + off, which);
+        }
+        return pos_type(off_type(-1));
+    }
+
+    pos_type seekpos(pos_type pos, std::ios::openmode) override {
+        const auto off = static_cast<off_type>(pos);
+        if (off < 0 || static_cast<size_t>(off) > size_) {
+            return pos_type(off_type(-1));
+        }
+        setg(data_, data_ + off, data_ + size_);
+        return pos;
+    }
+
+  public:
+    MappedBuf(const MappedBuf&) = delete;
+    MappedBuf& operator=(const MappedBuf&) = delete;
+
+    // leaves the buffer unmapped if the file is empty or can't be mapped
+    explicit MappedBuf(const std::string& path) {
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            auto addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data_ = static_cast<char*>(addr);
+                size_ = static_cast<size_t>(st.st_size);
+                // entries are read front to back, so have the kernel read ahead aggressively and
+                // drop pages behind
+                ::madvise(addr, size_, MADV_SEQUENTIAL);
+                setg(data_, data_, data_ + size_);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedBuf() override {
+        if (data_ != nullptr) {
+            ::munmap(data_, size_);
+        }
+    }
+
+    bool mapped() const {
+        return data_ != nullptr;
+    }
+
+    const uint8_t* cur() const {
+        return reinterpret_cast<const uint8_t*>(gptr());
+    }
+
+    size_t left() const {
+        return static_cast<size_t>(egptr() - gptr());
+    }
+};
+
 void Reader::read(void* buf, std::streamsize len) {
-    file_.read(reinterpret_cast<char*>(buf), len);
+    if (in_block_) {
+        const auto n = std::min(static_cast<size_t>(len), block_len_ - block_pos_);
+        std::memcpy(buf, block_data_ + block_pos_, n);
+        block_pos_ += n;
+        return;
+    }
+    file_->read(reinterpret_cast<char*>(buf), len);
 }
 
 void Reader::read(std::string* buf) {
-    std::getline(file_, *buf, '\0');
+    std::getline(*file_, *buf, '\0');
 }
 
 template <typename T>
@@ -16,22 +222,294 @@ void Reader::read(T* buf) {
     read(buf, sizeof(T));
 }
 
+void Reader::set_payload(const uint8_t* data, size_t len) {
+    if (mapped_ != nullptr) {
+        payload_ = data;
+        payload_len_ = len;
+        return;
+    }
+    // a block's buffer is reused for the next block, so its payloads are copied out
+    data_.assign(data, data + len);
+    payload_ = data_.data();
+    payload_len_ = data_.size();
+}
+
+bool Reader::valid(const BlockHdr& hdr) const {
+    auto hdr_crc = hdr.hdr_crc;
+    if (native_ == 0) {
+        hdr_crc = byteswap(hdr_crc);
+    }
+    return hdr.sync == (native_ == 0 ? byteswap(BLOCK_SYNC) : BLOCK_SYNC)
+        && crc32c(0, &hdr, offsetof(BlockHdr, hdr_crc)) == hdr_crc;
+}
+
+bool Reader::resync(BlockHdr& hdr) {
+    const auto sync = native_ == 0 ? byteswap(BLOCK_SYNC) : BLOCK_SYNC;
+    const auto sync_bytes = reinterpret_cast<const uint8_t*>(&sync);
+    std::vector<uint8_t> window(sizeof(hdr));
+    std::memcpy(window.data(), &hdr, sizeof(hdr));
+    uint64_t skipped = 0;
+    // the bad header's own sync marker is not looked at again
+    size_t from = 1;
+    for (;;) {
+        auto it = std::search(window.begin() + static_cast<std::ptrdiff_t>(from), window.end(), sync_bytes, sync_bytes + sizeof(sync));
+        if (it != window.end()) {
+            skipped += static_cast<uint64_t>(it - window.begin());
+            window.erase(window.begin(), it);
+            break;
+        }
+        // a marker may start in the last few bytes
+        const auto keep = std::min(window.size(), sizeof(sync) - 1);
+        skipped += window.size() - keep;
+        window.erase(window.begin(), window.end() - static_cast<std::ptrdiff_t>(keep));
+        from = 0;
+        // reading no more than a header ahead keeps the seek back below within what a
+        // compressed file's FrameBuf can still go back to
+        const auto old = window.size();
+        window.resize(old + sizeof(hdr));
+        read(window.data() + old, sizeof(hdr));
+        window.resize(old + static_cast<size_t>(file_->gcount()));
+        if (!*file_) {
+            return false;
+        }
+    }
+    if (window.size() < sizeof(hdr)) {
+        const auto old = window.size();
+        window.resize(sizeof(hdr));
+        read(window.data() + old, static_cast<std::streamsize>(sizeof(hdr) - old));
+        if (!*file_) {
+            return false;
+        }
+    }
+    std::memcpy(&hdr, window.data(), sizeof(hdr));
+    if (window.size() > sizeof(hdr)) {
+        file_->seekg(-static_cast<std::streamoff>(window.size() - sizeof(hdr)), std::ios::cur);
+    }
+    spdlog::warn("skipped {} corrupt bytes in {}", skipped, path_);
+    return true;
+}
+
+bool Reader::next_block() {
+    in_block_ = false;
+    BlockHdr hdr{};
+    read(&hdr);
+    while (*file_) {
+        if (!valid(hdr)) {
+            if (!resync(hdr)) {
+                break;
+            }
+            continue;
+        }
+        if (native_ == 0) {
+            hdr.first_id = byteswap(hdr.first_id);
+            hdr.last_id = byteswap(hdr.last_id);
+            hdr.first_ts = byteswap(hdr.first_ts);
+            hdr.last_ts = byteswap(hdr.last_ts);
+            hdr.len = byteswap(hdr.len);
+            hdr.crc = byteswap(hdr.crc);
+            hdr.flags = byteswap(hdr.flags);
+        }
+        if (mapped_ != nullptr) {
+            // the block is parsed where it is in the mapping rather than copied out of it
+            block_data_ = mapped_->cur();
+            block_len_ = static_cast<size_t>(std::min<uint64_t>(hdr.len, mapped_->left()));
+            file_->seekg(static_cast<std::streamoff>(block_len_), std::ios::cur);
+            if (block_len_ < hdr.len) {
+                file_->setstate(std::ios::failbit);
+            }
+        } else {
+            block_buf_.resize(hdr.len);
+            read(block_buf_.data(), static_cast<std::streamsize>(block_buf_.size()));
+            block_data_ = block_buf_.data();
+            block_len_ = block_buf_.size();
+        }
+        BlockFtr ftr{};
+        read(&ftr);
+        if (!*file_) {
+            spdlog::warn("{} ends in a partly written block, entries {} to {} are lost", path_, hdr.first_id, hdr.last_id);
+            return false;
+        }
+        if (crc32c(0, block_data_, block_len_) == hdr.crc) {
+            block_pos_ = 0;
+            in_block_ = true;
+            block_flags_ = hdr.flags;
+            prev_id_ = hdr.first_id;
+            prev_ts_ = hdr.first_ts;
+            block_last_id_ = hdr.last_id;
+            block_last_ts_ = hdr.last_ts;
+            return true;
+        }
+        spdlog::warn("corrupt block in {}, entries {} to {} are lost", path_, hdr.first_id, hdr.last_id);
+        read(&hdr);
+    }
+    return false;
+}
+
+bool Reader::read_varint(uint64_t& v) {
+    v = 0;
+    for (unsigned shift = 0; shift < 64 && block_pos_ < block_len_; shift += 7) {
+        const auto byte = block_data_[block_pos_++];
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Reader::read_compact() {
+    uint64_t tag = 0;
+    uint64_t ts_delta = 0;
+    if (!read_varint(tag) || !read_varint(ts_delta)) {
+        return false;
+    }
+    prev_id_ += tag >> 2;
+    prev_ts_ += static_cast<uint64_t>(unzigzag(ts_delta));
+    const auto secs = prev_ts_ / 1'000'000'000;
+    auto frac = prev_ts_ % 1'000'000'000;
+    if ((block_flags_ & BLOCK_NANO) == 0) {
+        frac /= 1000;
+    }
+    if ((tag & 2) != 0) {
+        auto& hdr = hdr_.template emplace<StatHdr>();
+        hdr.id = prev_id_;
+        hdr.secs = secs;
+        hdr.frac = frac;
+        return read_varint(hdr.recv) && read_varint(hdr.iface_drops) && read_varint(hdr.os_drops)
+            && read_varint(hdr.suppressed) && read_varint(hdr.queue_drops);
+    }
+    auto& hdr = hdr_.template emplace<PktHdr>();
+    hdr.id = prev_id_;
+    hdr.secs = secs;
+    hdr.frac = frac;
+    uint64_t caplen = 0;
+    uint64_t len = 0;
+    if (!read_varint(caplen) || ((tag & 1) != 0 && !read_varint(len)) || caplen > block_len_ - block_pos_) {
+        return false;
+    }
+    hdr.caplen = static_cast<uint32_t>(caplen);
+    hdr.len = (tag & 1) != 0 ? static_cast<uint32_t>(len) : hdr.caplen;
+    set_payload(block_data_ + block_pos_, hdr.caplen);
+    block_pos_ += caplen;
+    return true;
+}
+
+void Reader::load_index() {
+    std::ifstream file(index_path(path_), std::ios::binary);
+    if (!file) {
+        return;
+    }
+    uint32_t magic = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    if (magic != INDEX_MAGIC && magic != byteswap(INDEX_MAGIC)) {
+        spdlog::warn("{} is not a fastcap index, ignoring it", index_path(path_));
+        return;
+    }
+    IndexEntry entry{};
+    // a partly written last entry is left out
+    while (file.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+        if (magic != INDEX_MAGIC) {
+            entry.offset = byteswap(entry.offset);
+            entry.first_id = byteswap(entry.first_id);
+            entry.first_ts = byteswap(entry.first_ts);
+        }
+        index_.push_back(entry);
+    }
+}
+
+void Reader::seek(bool by_time, uint64_t target, bool nano) {
+    if (native_ < 0) {
+        return;
+    }
+    bool hop = version_ == 2;
+    if (index_.empty()) {
+        // without an index only later blocks can be skipped, and not if the target is in this one
+        hop = hop && !(in_block_ && (by_time ? block_last_ts_ : block_last_id_) >= target);
+    } else {
+        auto it = std::upper_bound(index_.begin(), index_.end(), target, [by_time](uint64_t t, const IndexEntry& entry) {
+            return t < (by_time ? entry.first_ts : entry.first_id);
+        });
+        if (it != index_.begin()) {
+            --it;
+        }
+        file_->clear();
+        file_->seekg(static_cast<std::streamoff>(it->offset));
+    }
+    if (hop) {
+        // drop what is left of the current block
+        in_block_ = false;
+        block_len_ = 0;
+        block_pos_ = 0;
+        done_ = false;
+        file_->clear();
+        // blocks that end before the target are skipped by their headers
+        for (;;) {
+            const auto pos = file_->tellg();
+            BlockHdr hdr{};
+            read(&hdr);
+            if (!*file_ || !valid(hdr)) {
+                file_->clear();
+                file_->seekg(pos);
+                break;
+            }
+            auto last = by_time ? hdr.last_ts : hdr.last_id;
+            auto len = hdr.len;
+            if (native_ == 0) {
+                last = byteswap(last);
+                len = byteswap(len);
+            }
+            file_->seekg(pos);
+            if (last >= target) {
+                break;
+            }
+            file_->seekg(static_cast<std::streamoff>(sizeof(BlockHdr) + len + sizeof(BlockFtr)), std::ios::cur);
+        }
+        read_next();
+    }
+    auto key = [&] {
+        return std::visit([&](const auto& hdr) {
+            return by_time ? (hdr.secs * 1'000'000'000) + (hdr.frac * (nano ? 1 : 1000)) : hdr.id;
+        }, hdr_);
+    };
+    while (!done_ && key() < target) {
+        read_next();
+    }
+}
+
 void Reader::read_next() {
-    if (file_.eof()) {
+    if (version_ == 2) {
+        while (block_pos_ == block_len_) {
+            if (!next_block()) {
+                done_ = true;
+                return;
+            }
+        }
+        if ((block_flags_ & BLOCK_COMPACT) != 0) {
+            if (!read_compact()) {
+                // only possible for a block that was written wrong, its CRC was fine
+                spdlog::warn("malformed entry in {}, skipping the rest of its block", path_);
+                block_pos_ = block_len_;
+                read_next();
+            }
+            return;
+        }
+    } else if (!*file_) {
         done_ = true;
         return;
     }
 
     uint64_t entry_id = 0;
     read(&entry_id);
-    if (file_.eof()) {
+    if (!in_block_ && !*file_) {
         done_ = true;
         return;
     }
     if ((entry_id & (1ull << 63)) > 0) {
         auto& hdr = hdr_.template emplace<StatHdr>();
         hdr.id = entry_id & ~(1ull << 63);
-        read(reinterpret_cast<char*>(&hdr) + sizeof(uint64_t), sizeof(StatHdr) - sizeof(uint64_t));
+        // counters added since version 1 are left at zero for version 1 files
+        const auto stat_len = version_ == 2 ? sizeof(StatHdr) : STAT_V1_LEN;
+        read(reinterpret_cast<char*>(&hdr) + sizeof(uint64_t), static_cast<std::streamsize>(stat_len - sizeof(uint64_t)));
         if (native_ == 0) {
             hdr.id = byteswap(hdr.id);
             hdr.secs = byteswap(hdr.secs);
@@ -39,13 +517,15 @@ void Reader::read_next() {
             hdr.recv = byteswap(hdr.recv);
             hdr.iface_drops = byteswap(hdr.iface_drops);
             hdr.os_drops = byteswap(hdr.os_drops);
+            if (version_ == 2) {
+                hdr.suppressed = byteswap(hdr.suppressed);
+                hdr.queue_drops = byteswap(hdr.queue_drops);
+            }
         }
     } else {
         auto& hdr = hdr_.template emplace<PktHdr>();
         hdr.id = entry_id;
         read(reinterpret_cast<char*>(&hdr) + sizeof(uint64_t), sizeof(PktHdr) - sizeof(uint64_t));
-        data_.resize(hdr.caplen);
-        read(data_.data(), data_.size());
         if (native_ == 0) {
             hdr.id = byteswap(hdr.id);
             hdr.secs = byteswap(hdr.secs);
@@ -53,17 +533,53 @@ void Reader::read_next() {
             hdr.len = byteswap(hdr.len);
             hdr.caplen = byteswap(hdr.caplen);
         }
+        if (in_block_) {
+            const auto n = std::min<size_t>(hdr.caplen, block_len_ - block_pos_);
+            set_payload(block_data_ + block_pos_, n);
+            block_pos_ += n;
+        } else if (mapped_ != nullptr) {
+            const auto n = std::min<size_t>(hdr.caplen, mapped_->left());
+            set_payload(mapped_->cur(), n);
+            file_->seekg(static_cast<std::streamoff>(n), std::ios::cur);
+            if (n < hdr.caplen) {
+                file_->setstate(std::ios::failbit);
+            }
+        } else {
+            data_.resize(hdr.caplen);
+            read(data_.data(), static_cast<std::streamsize>(data_.size()));
+            payload_ = data_.data();
+            payload_len_ = data_.size();
+        }
     }
 }
 
-Reader::Reader(const std::string& path) : file_(path) {
-    constexpr uint32_t NATIVE_MAGIC = 0x46434150;
-    constexpr uint32_t NON_NATIVE_MAGIC = 0x50414346;
+Reader::Reader(const std::string& path, bool mapped) : path_(path) {
+    std::ifstream file(path, std::ios::binary);
+    uint32_t frame_magic = 0;
+    file.read(reinterpret_cast<char*>(&frame_magic), sizeof(frame_magic));
+    file.clear();
+    file.seekg(0);
+    if (frame_magic == FRAME_MAGIC || frame_magic == FRAME_MAGIC_SWAPPED) {
+        frames_ = std::make_unique<FrameBuf>(std::move(file), frame_magic == FRAME_MAGIC_SWAPPED);
+        file_ = std::make_unique<std::istream>(frames_.get());
+    } else if (mapped) {
+        mapped_ = std::make_unique<MappedBuf>(path);
+        if (mapped_->mapped()) {
+            file_ = std::make_unique<std::istream>(mapped_.get());
+        } else {
+            mapped_.reset();
+            file_ = std::make_unique<std::ifstream>(std::move(file));
+        }
+    } else {
+        file_ = std::make_unique<std::ifstream>(std::move(file));
+    }
+
     uint32_t magic = 0;
     read(&magic);
-    if (magic == NATIVE_MAGIC) {
+    version_ = magic == MAGIC_V2 || magic == byteswap(MAGIC_V2) ? 2 : 1;
+    if (magic == MAGIC_V1 || magic == MAGIC_V2) {
         native_ = 1;
-    } else if (magic == NON_NATIVE_MAGIC) {
+    } else if (magic == byteswap(MAGIC_V1) || magic == byteswap(MAGIC_V2)) {
         native_ = 0;
     } else {
         spdlog::error("{} is not a fastcap file", path);
@@ -73,11 +589,28 @@ Reader::Reader(const std::string& path) : file_(path) {
 
     uint64_t entry_id = 0;
     read(&entry_id);
-    file_.seekg(-static_cast<std::streamoff>(sizeof(uint64_t)), std::ios::cur);
+    if (!*file_) {
+        // nothing but the magic number
+        return;
+    }
+    file_->seekg(-static_cast<std::streamoff>(sizeof(uint64_t)), std::ios::cur);
     has_lead_ = entry_id == 0;
+    // offsets in the index are into the file as stored
+    if (version_ == 2 && frames_ == nullptr) {
+        load_index();
+    }
 }
 
+Reader::Reader(Reader&&) noexcept = default;
+Reader& Reader::operator=(Reader&&) noexcept = default;
+Reader::~Reader() = default;
+
 void ReaderSet::read_lead(Reader& r) {
+    // rotated segments all repeat the same lead
+    ipv4s_.clear();
+    ipv6s_.clear();
+    mac_.reset();
+
     uint64_t entry_id = 0;
     r.read(&entry_id);
     r.read(&cpu_model_);
@@ -127,24 +660,53 @@ void ReaderSet::read_lead(Reader& r) {
         link_ = byteswap(link_);
     }
 
-    auto pos = r.file_.tellg();
-    r.file_.seekg(8, std::ios::cur);
-    r.read(&start_sec_);
-    if (r.native_ == 0) {
-        start_sec_ = byteswap(start_sec_);
+    // the capture starts with the earliest first entry of all files that have a lead
+    auto pos = r.file_->tellg();
+    uint64_t start_sec = 0;
+    uint64_t start_frac = 0;
+    bool found = false;
+    if (r.version_ == 2) {
+        // compact entries have no fixed layout, so it comes from the first block's header
+        BlockHdr hdr{};
+        r.read(&hdr);
+        if (*r.file_ && r.valid(hdr)) {
+            auto first_ts = hdr.first_ts;
+            auto flags = hdr.flags;
+            if (r.native_ == 0) {
+                first_ts = byteswap(first_ts);
+                flags = byteswap(flags);
+            }
+            start_sec = first_ts / 1'000'000'000;
+            start_frac = first_ts % 1'000'000'000;
+            if ((flags & BLOCK_NANO) == 0) {
+                start_frac /= 1000;
+            }
+            found = true;
+        }
+    } else {
+        r.file_->seekg(8, std::ios::cur);
+        r.read(&start_sec);
+        r.read(&start_frac);
+        if (r.native_ == 0) {
+            start_sec = byteswap(start_sec);
+            start_frac = byteswap(start_frac);
+        }
+        found = static_cast<bool>(*r.file_);
     }
-    r.read(&start_frac_);
-    if (r.native_ == 0) {
-        start_frac_ = byteswap(start_frac_);
+    if (found && (!has_start_ || std::make_pair(start_sec, start_frac) < std::make_pair(start_sec_, start_frac_))) {
+        start_sec_ = start_sec;
+        start_frac_ = start_frac;
+        has_start_ = true;
     }
-    r.file_.seekg(pos);
+    r.file_->clear();
+    r.file_->seekg(pos);
 }
 
-ReaderSet::ReaderSet(const std::vector<std::string>& paths) {
+ReaderSet::ReaderSet(const std::vector<std::string>& paths, bool mapped) {
     readers_.reserve(paths.size());
     bool ok = true;
     for (auto path : paths) {
-        auto& reader = readers_.emplace_back(path);
+        auto& reader = readers_.emplace_back(path, mapped);
         if (reader.native_ < 0) {
             ok = false;
             continue;
@@ -163,6 +725,20 @@ ReaderSet::ReaderSet(const std::vector<std::string>& paths) {
 
 std::optional<std::variant<PktHdr, StatHdr>>
 ReaderSet::next(std::vector<uint8_t>& data) {
+    ByteSpan span{};
+    auto hdr = next(span);
+    if (hdr && std::holds_alternative<PktHdr>(*hdr)) {
+        if (span.data == held_.data()) {
+            std::swap(data, held_);
+        } else {
+            data.assign(span.data, span.data + span.size);
+        }
+    }
+    return hdr;
+}
+
+std::optional<std::variant<PktHdr, StatHdr>>
+ReaderSet::next(ByteSpan& data) {
     for (;;) {
         size_t done_count = 0;
         for (auto& reader : readers_) {
@@ -174,7 +750,12 @@ ReaderSet::next(std::vector<uint8_t>& data) {
                 if (id == next_) {
                     ++next_;
                     if (is_pkt) {
-                        std::swap(data, reader.data_);
+                        if (reader.mapped_ != nullptr) {
+                            data = {reader.payload_, reader.payload_len_};
+                        } else {
+                            std::swap(held_, reader.data_);
+                            data = {held_.data(), held_.size()};
+                        }
                     }
                     auto hdr = reader.hdr_;
                     reader.read_next();
@@ -187,9 +768,45 @@ ReaderSet::next(std::vector<uint8_t>& data) {
         if (done_count == readers_.size()) {
             return std::nullopt;
         }
-        spdlog::warn("missing entry {}", next_);
-        ++next_;
+        // files lost to segment rotation leave whole ranges missing, so skip to the next entry
+        // any file has rather than stepping through them
+        uint64_t first = UINT64_MAX;
+        for (const auto& reader : readers_) {
+            if (!reader.done_) {
+                first = std::min(first, std::visit([](const auto& hdr) { return hdr.id; }, reader.hdr_));
+            }
+        }
+        if (first == next_ + 1) {
+            spdlog::warn("missing entry {}", next_);
+        } else {
+            spdlog::warn("missing entries {} to {}", next_, first - 1);
+        }
+        next_ = first;
+    }
+}
+
+void ReaderSet::seeked() {
+    next_ = UINT64_MAX;
+    for (const auto& reader : readers_) {
+        if (!reader.done_) {
+            next_ = std::min(next_, std::visit([](const auto& hdr) { return hdr.id; }, reader.hdr_));
+        }
+    }
+}
+
+void ReaderSet::seek_id(uint64_t id) {
+    for (auto& reader : readers_) {
+        reader.seek(false, id, nano_);
+    }
+    seeked();
+}
+
+void ReaderSet::seek_time(uint64_t secs, uint64_t frac) {
+    const auto ns = (secs * 1'000'000'000) + (frac * (nano_ ? 1 : 1000));
+    for (auto& reader : readers_) {
+        reader.seek(true, ns, nano_);
     }
+    seeked();
 }
 
 const std::string& ReaderSet::cpu_model() const {
@@ -1,118 +1,173 @@
 #include <fastcap/ring_buffer.hpp>
+#include <fastcap/memory.hpp>
 
-size_t RingBuffer::offset_add(size_t pos, size_t offset) const noexcept {
-    const auto cap = cap_;
-    pos += offset;
-    return pos - (cap * static_cast<size_t>(pos >= cap));
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <climits>
+#include <ctime>
+
+size_t RingBuffer::index(uint64_t pos) const noexcept {
+    return static_cast<size_t>(pos % cap_);
 }
 
-size_t RingBuffer::decrement(size_t pos) const noexcept {
-    const auto cond = static_cast<size_t>(pos == 0);
-    const auto not_cond = cond ^ 1;
-    return ((pos - 1) * not_cond) | ((cap_ - 1) * cond);
+uint64_t* RingBuffer::length_word(uint64_t pos) const noexcept {
+    return reinterpret_cast<uint64_t*>(mem_ + index(pos));
 }
 
-size_t RingBuffer::distance(size_t start, size_t end) const noexcept {
-    const auto cond = static_cast<size_t>(end < start);
-    const auto not_cond = cond ^ 1;
-    return ((end - start) * not_cond) | ((cap_ - end + start) * cond);
+uint64_t RingBuffer::entry_size(uint64_t len) noexcept {
+    return sizeof(uint64_t) + ((len + 7) & ~uint64_t{7});
 }
 
-void RingBuffer::write_impl(size_t pos, const void* buf, size_t len) {
-    const auto cap = cap_;
-    if (pos + len > cap) {
-        const auto first_len = cap - pos;
-        const auto second_len = len - first_len;
-        std::memcpy(mem_ + pos, buf, first_len);
-        std::memcpy(mem_, reinterpret_cast<const uint8_t*>(buf) + first_len, second_len);
-    } else {
-        std::memcpy(mem_ + pos, buf, len);
-    }
+RingBuffer::RingBuffer(size_t capacity, const Config& config, int node, bool single_consumer)
+    : cap_(capacity),
+      spin_count_(static_cast<uint32_t>(config.spin_count)),
+      yield_count_(static_cast<uint32_t>(config.yield_count)),
+      single_consumer_(single_consumer) {
+    mem_ = reinterpret_cast<uint8_t*>(map_mirrored_buffer(cap_, config, node));
+}
+
+RingBuffer::~RingBuffer() {
+    unmap_buffer(mem_, 2 * cap_);
+}
+
+bool RingBuffer::ok() const {
+    return mem_ != nullptr;
 }
 
-void RingBuffer::read_impl(size_t pos, void* buf, size_t len) {
-    const auto cap = cap_;
-    if (pos + len > cap) {
-        const auto first_len = cap - pos;
-        const auto second_len = len - first_len;
-        std::memcpy(buf, mem_ + pos, first_len);
-        std::memcpy(reinterpret_cast<uint8_t*>(buf) + first_len, mem_, second_len);
-    } else {
-        std::memcpy(buf, mem_ + pos, len);
+double RingBuffer::occupancy() const {
+    const auto begin = begin_.load(std::memory_order_relaxed);
+    const auto end = end_.load(std::memory_order_relaxed);
+    return end > begin ? static_cast<double>(end - begin) / static_cast<double>(cap_) : 0.0;
+}
+
+bool RingBuffer::empty() const noexcept {
+    return begin_.load(std::memory_order_relaxed) == end_.load(std::memory_order_acquire);
+}
+
+void RingBuffer::futex_wait(uint32_t seq, std::chrono::nanoseconds timeout) {
+    if (timeout.count() < 0) {
+        syscall(SYS_futex, &wake_seq_, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+        return;
     }
+    timespec ts{
+        static_cast<time_t>(timeout.count() / 1000000000),
+        static_cast<long>(timeout.count() % 1000000000)
+    };
+    syscall(SYS_futex, &wake_seq_, FUTEX_WAIT_PRIVATE, seq, &ts, nullptr, 0);
 }
 
-RingBuffer::RingBuffer(size_t capacity)
-    : mem_(new uint8_t[capacity]),
-      cap_(capacity),
-      free_end_(capacity - 1) {}
+void RingBuffer::futex_wake(int count) {
+    syscall(SYS_futex, &wake_seq_, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
 
-RingBuffer::~RingBuffer() {
-    delete[] mem_;
+void RingBuffer::cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
 }
 
 void RingBuffer::notify_one_consumer() {
-    if (mut_.try_lock()) {
-        mut_.unlock();
+    // pairs with the sleepers_ increment in try_read_do_while
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) == 0) {
+        return;
     }
-    cv_.notify_one();
+    wake_seq_.fetch_add(1);
+    futex_wake(1);
 }
 
 void RingBuffer::notify_all_consumers() {
-    if (mut_.try_lock()) {
-        mut_.unlock();
+    wake_seq_.fetch_add(1);
+    futex_wake(INT_MAX);
+}
+
+void RingBuffer::reclaim() {
+    // only committed entries can be released, so this never runs into the one being written
+    while (tail_ != head_) {
+        const auto word = __atomic_load_n(length_word(tail_), __ATOMIC_ACQUIRE);
+        if ((word & RELEASED) == 0) {
+            break;
+        }
+        tail_ += entry_size(word & ~RELEASED);
     }
-    cv_.notify_all();
 }
 
-bool RingBuffer::prepare_write(size_t num_bytes) {
-    auto needed_bytes = num_bytes + sizeof(size_t);
-    auto end = end_.load(std::memory_order_relaxed);
-    auto free_end = free_end_.load(std::memory_order_relaxed);
-    auto free_len = distance(end, free_end);
-    if (needed_bytes > free_len) {
-        return false;
+uint8_t* RingBuffer::prepare_write(size_t num_bytes) {
+    const auto needed_bytes = entry_size(num_bytes);
+    if (head_ + needed_bytes - tail_ > cap_) {
+        reclaim();
+        if (head_ + needed_bytes - tail_ > cap_) {
+            return nullptr;
+        }
     }
 
-    write_impl(end, &num_bytes, sizeof(size_t));
-    write_pos_ = offset_add(end, sizeof(size_t));
-    write_end_ = offset_add(write_pos_, num_bytes);
-    return true;
+    __atomic_store_n(length_word(head_), static_cast<uint64_t>(num_bytes), __ATOMIC_RELAXED);
+    write_ptr_ = mem_ + index(head_ + sizeof(uint64_t));
+    write_end_ = head_ + needed_bytes;
+    return write_ptr_;
 }
 
 void RingBuffer::write_some(const void* buf, size_t len) {
-    write_impl(write_pos_, buf, len);
-    write_pos_ = offset_add(write_pos_, len);
+    std::memcpy(write_ptr_, buf, len);
+    write_ptr_ += len;
 }
 
 void RingBuffer::commit_write() {
-    end_.store(write_end_);
+    head_ = write_end_;
+}
+
+void RingBuffer::publish() {
+    if (end_.load(std::memory_order_relaxed) == head_) {
+        return;
+    }
+    end_.store(head_, std::memory_order_release);
     notify_one_consumer();
 }
 
-bool RingBuffer::try_read(std::vector<uint8_t>& buf) {
-    std::ptrdiff_t tmp_begin = -1;
-    while ((tmp_begin = begin_.exchange(-1, std::memory_order_relaxed)) < 0);
-    size_t begin = static_cast<size_t>(tmp_begin);
-    if (begin == end_.load(std::memory_order_relaxed)) {
-        begin_.store(tmp_begin, std::memory_order_relaxed);
-        notify_one_consumer();
-        return false;
+bool RingBuffer::try_claim(RingSpan& span, size_t max_bytes) {
+    auto begin = begin_.load(std::memory_order_relaxed);
+    uint64_t end = 0;
+    do {
+        const auto published = end_.load(std::memory_order_acquire);
+        if (begin == published) {
+            return false;
+        }
+        // if another consumer got here first the slots may already be reused, but then the CAS fails
+        end = begin;
+        do {
+            end += entry_size(__atomic_load_n(length_word(end), __ATOMIC_RELAXED) & ~RELEASED);
+        } while (end < published && end - begin < max_bytes);
+        if (single_consumer_) {
+            begin_.store(end, std::memory_order_relaxed);
+            break;
+        }
+    } while (!begin_.compare_exchange_weak(begin, end, std::memory_order_relaxed));
+
+    span.begin = begin;
+    span.end = end;
+    return true;
+}
+
+void RingBuffer::release(const RingSpan& span) {
+    for (auto pos = span.begin; pos != span.end;) {
+        const auto len = __atomic_load_n(length_word(pos), __ATOMIC_RELAXED);
+        __atomic_store_n(length_word(pos), len | RELEASED, __ATOMIC_RELEASE);
+        pos += entry_size(len);
     }
+}
 
-    size_t len = 0;
-    read_impl(begin, &len, sizeof(size_t));
-    auto new_begin = offset_add(begin, len + sizeof(size_t));
-    begin_.store(static_cast<std::ptrdiff_t>(new_begin), std::memory_order_relaxed);
-    notify_one_consumer();
-    buf.resize(len);
-    read_impl(offset_add(begin, sizeof(size_t)), buf.data(), len);
-    size_t new_end = decrement(new_begin);
-    size_t expected_end = decrement(begin);
-    size_t tmp_end = expected_end;
-    while (!free_end_.compare_exchange_strong(tmp_end, new_end)) {
-        tmp_end = expected_end;
+bool RingBuffer::try_read(std::vector<uint8_t>& buf) {
+    RingSpan span;
+    if (!try_claim(span, 0)) {
+        return false;
     }
+    buf.resize(__atomic_load_n(length_word(span.begin), __ATOMIC_RELAXED));
+    std::memcpy(buf.data(), mem_ + index(span.begin + sizeof(uint64_t)), buf.size());
+    release(span);
     return true;
 }
 
@@ -0,0 +1,151 @@
+#include <fastcap/segment.hpp>
+#include <fastcap/block.hpp>
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+#include <unistd.h>
+
+SegmentRotator::SegmentRotator(const Config& config, int node, const std::vector<std::string>& paths, std::vector<uint8_t> header)
+    : config_(config),
+      node_(node),
+      header_(std::move(header)),
+      prealloc_(static_cast<uint64_t>(config.rotate_size) << 20) {
+    slots_.reserve(paths.size());
+    for (const auto& path : paths) {
+        auto& slot = *slots_.emplace_back(std::make_unique<Slot>());
+        slot.ext = std::filesystem::path(path).extension().string();
+        slot.stem = path.substr(0, path.size() - slot.ext.size());
+    }
+}
+
+SegmentRotator::~SegmentRotator() {
+    stop();
+}
+
+std::unique_ptr<OutputFile> SegmentRotator::open(Slot& slot, std::string& path) {
+    path = fmt::format("{}-{:06}{}", slot.stem, slot.next_seg++, slot.ext);
+    auto out = std::make_unique<OutputFile>(path, config_, node_);
+    if (!out->ok()) {
+        return out;
+    }
+    if (prealloc_ > 0) {
+        out->preallocate(prealloc_);
+    }
+    iovec iov{header_.data(), header_.size()};
+    out->write(&iov, 1);
+    return out;
+}
+
+std::unique_ptr<OutputFile> SegmentRotator::first(size_t idx) {
+    auto& slot = *slots_[idx];
+    std::string path;
+    auto out = open(slot, path);
+    slot.paths.push_back(path);
+    return out;
+}
+
+void SegmentRotator::start() {
+    worker_ = std::thread([this] { work(); });
+}
+
+bool SegmentRotator::rotate(size_t idx, std::unique_ptr<OutputFile>& out) {
+    auto& slot = *slots_[idx];
+    if (!slot.ready.load(std::memory_order_acquire)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(out, slot.next);
+        slot.retired.push_back(std::move(slot.next));
+        slot.paths.push_back(std::move(slot.next_path));
+        slot.ready.store(false, std::memory_order_relaxed);
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void SegmentRotator::work() {
+    const auto max_segments = static_cast<size_t>(config_.segment_count);
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        bool retry = false;
+        for (auto& slot_ptr : slots_) {
+            auto& slot = *slot_ptr;
+            if (!slot.retired.empty()) {
+                auto retired = std::move(slot.retired);
+                slot.retired.clear();
+                lock.unlock();
+                // closing waits for outstanding writes, which is why it happens here
+                for (auto& out : retired) {
+                    out->close();
+                }
+                lock.lock();
+                while (max_segments > 0 && slot.paths.size() > max_segments) {
+                    if (unlink(slot.paths.front().c_str()) != 0) {
+                        spdlog::warn("failed to remove {}: {}", slot.paths.front(), strerror(errno));
+                    }
+                    unlink(index_path(slot.paths.front()).c_str());
+                    slot.paths.pop_front();
+                }
+            }
+            if (!stop_ && !slot.ready.load(std::memory_order_relaxed)) {
+                lock.unlock();
+                std::string path;
+                auto next = open(slot, path);
+                lock.lock();
+                if (next->ok()) {
+                    slot.next = std::move(next);
+                    slot.next_path = std::move(path);
+                    slot.ready.store(true, std::memory_order_release);
+                } else {
+                    next.reset();
+                    unlink(path.c_str());
+                    retry = true;
+                }
+            }
+        }
+        if (stop_) {
+            break;
+        }
+        auto pending = [this] {
+            for (const auto& slot : slots_) {
+                if (!slot->retired.empty() || !slot->ready.load(std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return stop_;
+        };
+        if (retry) {
+            cv_.wait_for(lock, std::chrono::seconds(1));
+        } else {
+            cv_.wait(lock, pending);
+        }
+    }
+
+    for (auto& slot : slots_) {
+        if (slot->ready.load(std::memory_order_relaxed)) {
+            slot->next->close();
+            slot->next.reset();
+            unlink(slot->next_path.c_str());
+            slot->ready.store(false, std::memory_order_relaxed);
+        }
+    }
+}
+
+void SegmentRotator::stop() {
+    if (!worker_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+}
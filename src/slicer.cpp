@@ -0,0 +1,259 @@
+#include <fastcap/slicer.hpp>
+
+#include <pcap.h>
+
+#include <algorithm>
+
+namespace {
+
+enum class Layer {
+    ether,
+    // IPv4 or IPv6, told apart by the version field
+    ip,
+    ipv4,
+    ipv6,
+    mpls,
+    transport,
+    done,
+};
+
+// guards against packets built to loop through tunnel headers
+constexpr int MAX_LAYERS = 16;
+
+constexpr uint16_t VXLAN_PORT = 4789;
+
+uint16_t load16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+Layer from_ethertype(uint16_t ethertype) {
+    switch (ethertype) {
+        case 0x0800:
+            return Layer::ipv4;
+        case 0x86DD:
+            return Layer::ipv6;
+        case 0x8847:
+        case 0x8848:
+            return Layer::mpls;
+        default:
+            return Layer::done;
+    }
+}
+
+bool is_vlan(uint16_t ethertype) {
+    return ethertype == 0x8100 || ethertype == 0x88A8 || ethertype == 0x9100;
+}
+
+}
+
+size_t header_length(int datalink, const uint8_t* pkt, size_t caplen) {
+    size_t off = 0;
+    Layer layer = Layer::done;
+    switch (datalink) {
+        case DLT_EN10MB:
+            layer = Layer::ether;
+            break;
+        case DLT_RAW:
+        case DLT_IPV4:
+        case DLT_IPV6:
+            layer = Layer::ip;
+            break;
+        case DLT_NULL:
+        case DLT_LOOP:
+            off = 4;
+            layer = Layer::ip;
+            break;
+        case DLT_LINUX_SLL:
+            if (caplen < 16) {
+                return caplen;
+            }
+            off = 16;
+            layer = from_ethertype(load16(pkt + 14));
+            break;
+#ifdef DLT_LINUX_SLL2
+        case DLT_LINUX_SLL2:
+            if (caplen < 20) {
+                return caplen;
+            }
+            off = 20;
+            layer = from_ethertype(load16(pkt));
+            break;
+#endif
+        default:
+            // nothing is known about the headers, so keep the whole packet
+            return caplen;
+    }
+
+    uint8_t proto = 0;
+    for (int depth = 0; depth < MAX_LAYERS && layer != Layer::done; ++depth) {
+        switch (layer) {
+            case Layer::ether: {
+                if (off + 14 > caplen) {
+                    return caplen;
+                }
+                auto ethertype = load16(pkt + off + 12);
+                off += 14;
+                while (is_vlan(ethertype)) {
+                    if (off + 4 > caplen) {
+                        return caplen;
+                    }
+                    ethertype = load16(pkt + off + 2);
+                    off += 4;
+                }
+                layer = from_ethertype(ethertype);
+                break;
+            }
+            case Layer::mpls: {
+                bool bottom = false;
+                while (!bottom) {
+                    if (off + 4 > caplen) {
+                        return caplen;
+                    }
+                    bottom = (pkt[off + 2] & 1) != 0;
+                    off += 4;
+                }
+                layer = Layer::ip;
+                break;
+            }
+            case Layer::ip:
+                if (off >= caplen) {
+                    return caplen;
+                }
+                switch (pkt[off] >> 4) {
+                    case 4:
+                        layer = Layer::ipv4;
+                        break;
+                    case 6:
+                        layer = Layer::ipv6;
+                        break;
+                    default:
+                        layer = Layer::done;
+                        break;
+                }
+                break;
+            case Layer::ipv4: {
+                if (off + 20 > caplen) {
+                    return caplen;
+                }
+                const size_t ihl = (pkt[off] & 0x0F) * 4u;
+                const auto frag_off = load16(pkt + off + 6) & 0x1FFF;
+                proto = pkt[off + 9];
+                off += std::max<size_t>(ihl, 20);
+                // only the first fragment carries the transport header
+                layer = frag_off == 0 ? Layer::transport : Layer::done;
+                break;
+            }
+            case Layer::ipv6: {
+                if (off + 40 > caplen) {
+                    return caplen;
+                }
+                proto = pkt[off + 6];
+                off += 40;
+                layer = Layer::transport;
+                for (bool ext = true; ext && layer == Layer::transport;) {
+                    if (off + 8 > caplen) {
+                        return caplen;
+                    }
+                    const auto next = pkt[off];
+                    switch (proto) {
+                        case 0:
+                        case 43:
+                        case 60:
+                        case 135:
+                        case 139:
+                        case 140:
+                            off += (pkt[off + 1] + 1u) * 8;
+                            break;
+                        case 44:
+                            if ((load16(pkt + off + 2) & 0xFFF8) != 0) {
+                                layer = Layer::done;
+                            }
+                            off += 8;
+                            break;
+                        case 51:
+                            off += (pkt[off + 1] + 2u) * 4;
+                            break;
+                        default:
+                            ext = false;
+                            continue;
+                    }
+                    proto = next;
+                }
+                break;
+            }
+            case Layer::transport:
+                layer = Layer::done;
+                switch (proto) {
+                    case 6:
+                        if (off + 20 > caplen) {
+                            return caplen;
+                        }
+                        off += std::max<size_t>((pkt[off + 12] >> 4) * 4u, 20);
+                        break;
+                    case 17:
+                        if (off + 8 > caplen) {
+                            return caplen;
+                        }
+                        if (load16(pkt + off + 2) == VXLAN_PORT) {
+                            off += 8;
+                            layer = Layer::ether;
+                        }
+                        off += 8;
+                        break;
+                    case 1:
+                    case 58:
+                        off += 8;
+                        break;
+                    case 132:
+                        off += 12;
+                        break;
+                    case 4:
+                        layer = Layer::ipv4;
+                        break;
+                    case 41:
+                        layer = Layer::ipv6;
+                        break;
+                    case 47: {
+                        if (off + 4 > caplen) {
+                            return caplen;
+                        }
+                        const auto flags = load16(pkt + off);
+                        const auto type = load16(pkt + off + 2);
+                        off += 4;
+                        off += (flags & 0x8000) != 0 ? 4 : 0;
+                        off += (flags & 0x2000) != 0 ? 4 : 0;
+                        off += (flags & 0x1000) != 0 ? 4 : 0;
+                        if (type == 0x6558) {
+                            layer = Layer::ether;
+                        } else if (type == 0x88BE) {
+                            // ERSPAN type II
+                            off += 8;
+                            layer = Layer::ether;
+                        } else if (type == 0x22EB) {
+                            // ERSPAN type III
+                            off += 12;
+                            layer = Layer::ether;
+                        } else {
+                            layer = from_ethertype(type);
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+                break;
+            case Layer::done:
+                break;
+        }
+    }
+    return std::min(off, caplen);
+}
+
+Slicer::Slicer(int datalink, uint32_t payload)
+    : datalink_(datalink),
+      payload_(payload) {}
+
+uint32_t Slicer::slice(const uint8_t* pkt, uint32_t caplen) const {
+    const auto len = header_length(datalink_, pkt, caplen) + payload_;
+    return static_cast<uint32_t>(std::min<size_t>(caplen, len));
+}
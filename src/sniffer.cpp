@@ -1,18 +1,37 @@
 #include <fastcap/sniffer.hpp>
+#include <fastcap/sysinfo.hpp>
+#include <fastcap/tpacket.hpp>
 #include <fastcap/utils.hpp>
+#include <fastcap/xdp.hpp>
 
 #include <spdlog/spdlog.h>
 
 #include <pcap.h>
+#include <net/if.h>
+#include <net/if_arp.h>
 #include <sys/eventfd.h>
 #include <poll.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <limits>
+#include <thread>
 
-Sniffer::Sniffer(const Config& config) : stats_interval_(config.stats_interval) {
+Sniffer::Sniffer(const Config& config, const Placement& placement)
+    : stats_interval_(config.stats_interval),
+      capture_cpus_(placement.capture_cpus) {
+    if (config.backend == "tpacket") {
+        open_tpacket(config);
+    } else if (config.backend == "xdp") {
+        open_xdp(config, placement.node);
+    } else {
+        open_pcap(config);
+    }
+}
+
+void Sniffer::open_pcap(const Config& config) {
     char err_buf[PCAP_ERRBUF_SIZE];
     pcap_t* pcap = nullptr;
     auto stop_event = eventfd(0, 0);
@@ -136,6 +155,100 @@ Sniffer::Sniffer(const Config& config) : stats_interval_(config.stats_interval)
     std::swap(stop_event_, stop_event);
 }
 
+void Sniffer::open_tpacket(const Config& config) {
+    auto stop_event = eventfd(0, 0);
+    if (stop_event < 0) {
+        spdlog::error("failed to create sniffer stop event: {}", strerror(errno));
+        return;
+    }
+
+    const int fanout_id = config.capture_threads > 1 ? static_cast<int>(getpid() & 0xFFFF) : -1;
+    std::vector<std::unique_ptr<TPacketRing>> rings;
+    for (int i = 0; i < config.capture_threads; ++i) {
+        auto& ring = rings.emplace_back(std::make_unique<TPacketRing>(config, fanout_id));
+        if (!ring->ok()) {
+            close(stop_event);
+            return;
+        }
+    }
+
+    datalink_ = rings.front()->datalink();
+    nano_ = config.nano;
+    iface_ = config.iface;
+    base_iface_drops_ = iface_rx_dropped(iface_);
+    last_iface_drops_ = base_iface_drops_;
+    tpackets_ = std::move(rings);
+    stop_event_ = stop_event;
+}
+
+void Sniffer::open_xdp(const Config& config, int node) {
+    if (!config.filter.empty()) {
+        spdlog::error("capture filters are not supported by the xdp backend");
+        return;
+    }
+    if (config.rfmon) {
+        spdlog::error("monitor mode is not supported by the xdp backend");
+        return;
+    }
+    auto ifindex = static_cast<int>(if_nametoindex(config.iface.c_str()));
+    if (ifindex == 0) {
+        spdlog::error("no such interface {}", config.iface);
+        return;
+    }
+    auto link_type = iface_link_type(config.iface);
+    if (link_type != ARPHRD_ETHER && link_type != ARPHRD_LOOPBACK) {
+        spdlog::error("interface {} has a link type not supported by the xdp backend", config.iface);
+        return;
+    }
+
+    auto stop_event = eventfd(0, 0);
+    if (stop_event < 0) {
+        spdlog::error("failed to create sniffer stop event: {}", strerror(errno));
+        return;
+    }
+    auto guard = finally([&stop_event] {
+        if (stop_event >= 0) {
+            close(stop_event);
+        }
+    });
+
+    // capture thread i owns RX queue i
+    const auto queue_count = static_cast<size_t>(config.capture_threads);
+    const auto rx_queues = iface_rx_queues(config.iface);
+    if (rx_queues > queue_count) {
+        spdlog::warn("only {} of the {} RX queues of {} are captured", queue_count, rx_queues, config.iface);
+    }
+
+    auto program = std::make_unique<XdpProgram>(config, ifindex, std::max(queue_count, rx_queues));
+    if (!program->ok()) {
+        return;
+    }
+
+    bool zero_copy = program->native();
+    std::vector<std::unique_ptr<XdpSocket>> sockets;
+    for (int i = 0; i < config.capture_threads; ++i) {
+        auto socket = std::make_unique<XdpSocket>(config, ifindex, i, zero_copy, node);
+        if (!socket->ok() && zero_copy) {
+            spdlog::warn("interface {} does not support zero-copy AF_XDP, falling back to copy mode", config.iface);
+            zero_copy = false;
+            socket = std::make_unique<XdpSocket>(config, ifindex, i, zero_copy, node);
+        }
+        if (!socket->ok() || !program->add_socket(i, socket->fd())) {
+            return;
+        }
+        sockets.push_back(std::move(socket));
+    }
+
+    datalink_ = DLT_EN10MB;
+    nano_ = config.nano;
+    iface_ = config.iface;
+    base_iface_drops_ = iface_rx_dropped(iface_);
+    last_iface_drops_ = base_iface_drops_;
+    xdp_ = std::move(program);
+    xsks_ = std::move(sockets);
+    std::swap(stop_event_, stop_event);
+}
+
 Sniffer::~Sniffer() {
     if (pcap_ != nullptr) {
         pcap_close(pcap_);
@@ -148,6 +261,17 @@ Sniffer::~Sniffer() {
             prog_ = nullptr;
         }
     }
+    if (!tpackets_.empty()) {
+        tpackets_.clear();
+        close(stop_event_);
+        stop_event_ = -1;
+    }
+    if (!xsks_.empty()) {
+        xsks_.clear();
+        xdp_.reset();
+        close(stop_event_);
+        stop_event_ = -1;
+    }
 }
 
 int Sniffer::datalink() const {
@@ -155,17 +279,31 @@ int Sniffer::datalink() const {
 }
 
 bool Sniffer::ok() {
-    return pcap_ != nullptr;
+    return pcap_ != nullptr || !tpackets_.empty() || !xsks_.empty();
 }
 
 static void sniff_callback_c(u_char* user, const pcap_pkthdr* h, const u_char* bytes) {
-    auto [sniffer, writers] = *reinterpret_cast<std::pair<Sniffer*, WriterSet*>*>(user);
-    sniffer->sniff_callback(*writers, *h, bytes);
+    auto [sniffer, producer] = *reinterpret_cast<std::pair<Sniffer*, Producer*>*>(user);
+    sniffer->sniff_callback(*producer, *h, bytes);
 }
 
 int Sniffer::run(WriterSet& writers) {
     if (!ok()) { return 1; }
+    // the calling thread captures from the first socket
+    pin_thread(Placement::cpu(capture_cpus_, 0));
+    if (!tpackets_.empty()) {
+        return run_sockets(tpackets_, writers);
+    }
+    if (!xsks_.empty()) {
+        for (size_t i = 0; i < xsks_.size(); ++i) {
+            writers.producer(i).set_umem(&xsks_[i]->umem());
+        }
+        return run_sockets(xsks_, writers);
+    }
+    return run_pcap(writers.producer(0));
+}
 
+int Sniffer::run_pcap(Producer& producer) {
     pollfd events[2] = {
         {
             stop_event_,
@@ -207,17 +345,18 @@ int Sniffer::run(WriterSet& writers) {
         }
 
         if (pcap_poll.revents != 0) {
-            std::pair<Sniffer*, WriterSet*> user{this, &writers};
+            std::pair<Sniffer*, Producer*> user{this, &producer};
             if (pcap_dispatch(pcap_, -1, sniff_callback_c, reinterpret_cast<u_char*>(&user)) == PCAP_ERROR) {
                 spdlog::error("capture error: {}", pcap_geterr(pcap_));
                 return 1;
             }
+            producer.flush();
 
             if (do_stats) {
                 auto end = std::chrono::high_resolution_clock::now();
                 if (end - start >= interval) {
                     start = end;
-                    stats(writers);
+                    stats(producer);
                     just_did_stats = true;
                 } else {
                     just_did_stats = false;
@@ -226,12 +365,117 @@ int Sniffer::run(WriterSet& writers) {
         }
     }
     if (!just_did_stats) {
-        stats(writers);
+        stats(producer);
+    }
+
+    return 0;
+}
+
+template <typename Socket>
+int Sniffer::run_sockets(std::vector<std::unique_ptr<Socket>>& sockets, WriterSet& writers) {
+    // every socket gets its own thread and producer, the first one also reports stats
+    std::vector<std::thread> threads;
+    std::vector<int> rcs(sockets.size(), 0);
+    for (size_t i = 1; i < sockets.size(); ++i) {
+        threads.emplace_back([this, i, &sockets, &writers, &rcs] {
+            pin_thread(Placement::cpu(capture_cpus_, i));
+            bool just_did_stats = false;
+            rcs[i] = capture_socket(*sockets[i], writers.producer(i), false, just_did_stats);
+        });
+    }
+    bool just_did_stats = false;
+    rcs[0] = capture_socket(*sockets[0], writers.producer(0), stats_interval_ >= 0.0f, just_did_stats);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (!just_did_stats) {
+        stats(writers.producer(0));
     }
 
+    for (auto rc : rcs) {
+        if (rc != 0) {
+            return rc;
+        }
+    }
     return 0;
 }
 
+template <typename Socket>
+int Sniffer::capture_socket(Socket& socket, Producer& producer, bool do_stats, bool& just_did_stats) {
+    pollfd events[2] = {
+        {
+            stop_event_,
+            POLLIN,
+            0
+        },
+        {
+            socket.fd(),
+            POLLIN | POLLERR,
+            0
+        }
+    };
+    auto& stop_poll = events[0];
+    auto& socket_poll = events[1];
+
+    const auto interval = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<float>(stats_interval_));
+    auto start = std::chrono::high_resolution_clock::now();
+    while (!stop_flag_.load(std::memory_order_relaxed)) {
+        auto timeout = socket.poll_timeout();
+        if (do_stats && stats_interval_ > 0.0f) {
+            // wake up for the next stats entry even when no packets arrive
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(start + interval - std::chrono::high_resolution_clock::now());
+            const auto stats_timeout = static_cast<int>(std::max<int64_t>(left.count() + 1, 0));
+            timeout = timeout < 0 ? stats_timeout : std::min(timeout, stats_timeout);
+        }
+        auto rc = poll(events, 2, timeout);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            spdlog::error("failed to poll interface: {}", strerror(errno));
+            stop();
+            return 1;
+        }
+
+        if (stop_poll.revents != 0) {
+            break;
+        }
+
+        if (rc == 0 || socket_poll.revents != 0) {
+            socket.dispatch(producer);
+
+            if (do_stats) {
+                auto end = std::chrono::high_resolution_clock::now();
+                if (end - start >= interval) {
+                    start = end;
+                    stats(producer);
+                    just_did_stats = true;
+                } else {
+                    just_did_stats = false;
+                }
+            }
+        }
+    }
+    socket.dispatch(producer);
+
+    return 0;
+}
+
+template <typename Socket>
+bool Sniffer::socket_stats(std::vector<std::unique_ptr<Socket>>& sockets, uint64_t& recv, uint64_t& os_drops, uint64_t& last_ts) {
+    for (auto& socket : sockets) {
+        uint64_t socket_recv = 0;
+        uint64_t socket_drops = 0;
+        if (!socket->stats(socket_recv, socket_drops)) {
+            return false;
+        }
+        recv += socket_recv;
+        os_drops += socket_drops;
+        last_ts = std::max(last_ts, socket->last_timestamp());
+    }
+    return true;
+}
+
 int Sniffer::stop() {
     stop_flag_.store(true, std::memory_order_relaxed);
     const uint64_t value = 1;
@@ -242,17 +486,46 @@ int Sniffer::stop() {
     return 0;
 }
 
-void Sniffer::sniff_callback(WriterSet& writers, const pcap_pkthdr& hdr, const uint8_t* bytes) {
-    writers.write_packet(hdr, bytes);
+void Sniffer::sniff_callback(Producer& producer, const pcap_pkthdr& hdr, const uint8_t* bytes) {
+    producer.write_packet(hdr, bytes);
     last_ts_ = hdr.ts;
 }
 
-void Sniffer::stats(WriterSet& writers) {
+uint64_t Sniffer::iface_drops() {
+    const auto dropped = iface_rx_dropped(iface_);
+    if (dropped < last_iface_drops_) {
+        // some drivers reset the counters with the link, keep what was counted before and count
+        // from zero again
+        carried_iface_drops_ += last_iface_drops_ - base_iface_drops_;
+        base_iface_drops_ = 0;
+    }
+    last_iface_drops_ = dropped;
+    return carried_iface_drops_ + (dropped - base_iface_drops_);
+}
+
+void Sniffer::stats(Producer& producer) {
+    if (!tpackets_.empty() || !xsks_.empty()) {
+        uint64_t recv = 0;
+        uint64_t os_drops = 0;
+        uint64_t last_ts = 0;
+        if (!socket_stats(tpackets_, recv, os_drops, last_ts) || !socket_stats(xsks_, recv, os_drops, last_ts)) {
+            return;
+        }
+        auto iface_drops = this->iface_drops();
+        timeval ts{};
+        ts.tv_sec = static_cast<time_t>(last_ts / 1'000'000'000);
+        ts.tv_usec = static_cast<suseconds_t>(nano_ ? last_ts % 1'000'000'000 : (last_ts % 1'000'000'000) / 1000);
+        producer.write_stats(ts, recv, iface_drops, os_drops);
+        producer.flush();
+        return;
+    }
+
     pcap_stat stats{};
     if (pcap_stats(pcap_, &stats) != 0) {
         spdlog::error("failed to collect capture statistics: {}", pcap_geterr(pcap_));
         return;
     }
 
-    writers.write_stats(last_ts_, stats.ps_recv, stats.ps_ifdrop, stats.ps_drop);
+    producer.write_stats(last_ts_, stats.ps_recv, stats.ps_ifdrop, stats.ps_drop);
+    producer.flush();
 }
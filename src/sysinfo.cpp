@@ -1,5 +1,6 @@
 #include <fastcap/sysinfo.hpp>
 
+#include <algorithm>
 #include <cctype>
 #include <filesystem>
 #include <fstream>
@@ -377,3 +378,104 @@ uint64_t iface_speed(std::string_view iface) {
         return 0;
     }
 }
+
+static uint64_t read_counter(const std::string& filepath) {
+    if (!std::filesystem::exists(filepath)) {
+        return 0;
+    }
+    std::ifstream file{filepath};
+    std::string count;
+    file >> count;
+    uint64_t val = 0;
+    for (auto c : trim(count)) {
+        if (c >= '0' && c <= '9') {
+            val = (val * 10) + static_cast<uint64_t>(c - '0');
+        } else {
+            return 0;
+        }
+    }
+    return val;
+}
+
+uint64_t iface_rx_dropped(std::string_view iface) {
+    auto dropped = read_counter(fmt::format("/sys/class/net/{}/statistics/rx_dropped", iface));
+    auto missed = read_counter(fmt::format("/sys/class/net/{}/statistics/rx_missed_errors", iface));
+    return dropped + missed;
+}
+
+int iface_link_type(std::string_view iface) {
+    return static_cast<int>(read_counter(fmt::format("/sys/class/net/{}/type", iface)));
+}
+
+size_t iface_rx_queues(std::string_view iface) {
+    auto dirpath = fmt::format("/sys/class/net/{}/queues", iface);
+    if (!std::filesystem::exists(dirpath)) {
+        return 0;
+    }
+    size_t count = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(dirpath)) {
+        if (entry.path().filename().string().rfind("rx-", 0) == 0) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+int iface_numa_node(std::string_view iface) {
+    std::ifstream file{fmt::format("/sys/class/net/{}/device/numa_node", iface)};
+    int node = -1;
+    if (!(file >> node)) {
+        return -1;
+    }
+    return node;
+}
+
+std::vector<int> parse_cpu_list(std::string_view list) {
+    std::vector<int> cpus;
+    list = trim(list);
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto item = trim(list.substr(0, comma));
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+        auto dash = item.find('-');
+        auto first = std::string(item.substr(0, dash));
+        auto last = dash == std::string_view::npos ? first : std::string(item.substr(dash + 1));
+        if (first.empty() || last.empty()
+            || first.find_first_not_of("0123456789") != std::string::npos
+            || last.find_first_not_of("0123456789") != std::string::npos) {
+            return {};
+        }
+        for (auto cpu = std::stoi(first); cpu <= std::stoi(last); ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static std::vector<int> read_cpu_list(const std::string& filepath) {
+    std::ifstream file{filepath};
+    std::string list;
+    std::getline(file, list);
+    return parse_cpu_list(list);
+}
+
+std::vector<int> node_cpus(int node) {
+    if (node < 0) {
+        return read_cpu_list("/sys/devices/system/cpu/online");
+    }
+    auto cpus = read_cpu_list(fmt::format("/sys/devices/system/node/node{}/cpulist", node));
+    auto online = read_cpu_list("/sys/devices/system/cpu/online");
+    std::vector<int> ret;
+    for (auto cpu : cpus) {
+        if (std::find(online.begin(), online.end(), cpu) != online.end()) {
+            ret.push_back(cpu);
+        }
+    }
+    return ret;
+}
+
+bool cpu_is_primary_thread(int cpu) {
+    auto siblings = read_cpu_list(fmt::format("/sys/devices/system/cpu/cpu{}/topology/thread_siblings_list", cpu));
+    return siblings.empty() || siblings.front() == cpu;
+}
@@ -0,0 +1,279 @@
+#include <fastcap/tpacket.hpp>
+#include <fastcap/utils.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+static int arphrd_to_dlt(int arphrd) {
+    switch (arphrd) {
+        case ARPHRD_ETHER:
+        case ARPHRD_LOOPBACK:
+            return DLT_EN10MB;
+        case ARPHRD_NONE:
+            return DLT_RAW;
+        default:
+            return -1;
+    }
+}
+
+static int fanout_type(const std::string& mode) {
+    if (mode == "cpu") {
+        return PACKET_FANOUT_CPU;
+    } else if (mode == "queue") {
+        return PACKET_FANOUT_QM;
+    } else {
+        // keep IP fragments together so that a flow never splits across threads
+        return PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG;
+    }
+}
+
+TPacketRing::TPacketRing(const Config& config, int fanout_id)
+    : snaplen_(static_cast<uint32_t>(config.snaplen)),
+      nano_(config.nano) {
+    int fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        spdlog::error("failed to open packet socket: {}", strerror(errno));
+        return;
+    }
+    uint8_t* ring = nullptr;
+    size_t ring_size = 0;
+    auto guard = finally([&fd, &ring, &ring_size] {
+        if (ring != nullptr) {
+            munmap(ring, ring_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    });
+
+    int ifindex = static_cast<int>(if_nametoindex(config.iface.c_str()));
+    if (ifindex == 0) {
+        spdlog::error("no such interface {}", config.iface);
+        return;
+    }
+
+    ifreq ifr{};
+    std::strncpy(ifr.ifr_name, config.iface.c_str(), IF_NAMESIZE - 1);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        spdlog::error("failed to query link type of {}: {}", config.iface, strerror(errno));
+        return;
+    }
+    datalink_ = arphrd_to_dlt(ifr.ifr_hwaddr.sa_family);
+    if (datalink_ < 0) {
+        spdlog::error("interface {} has a link type not supported by the tpacket backend", config.iface);
+        return;
+    }
+
+    if (config.rfmon) {
+        spdlog::error("monitor mode is not supported by the tpacket backend");
+        return;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        spdlog::error("kernel does not support TPACKET_V3: {}", strerror(errno));
+        return;
+    }
+
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    block_size_ = static_cast<size_t>(config.block_size);
+    if (block_size_ < page_size || (block_size_ & (block_size_ - 1)) != 0) {
+        spdlog::error("tpacket block size must be a power of two of at least {} bytes", page_size);
+        return;
+    }
+    const auto ring_bytes = static_cast<size_t>(config.bufsz) / static_cast<size_t>(config.capture_threads);
+    block_count_ = std::max<size_t>(ring_bytes / block_size_, 2);
+
+    const unsigned frame_size = TPACKET_ALIGNMENT << 7;
+    tpacket_req3 req{};
+    req.tp_block_size = static_cast<unsigned>(block_size_);
+    req.tp_block_nr = static_cast<unsigned>(block_count_);
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = static_cast<unsigned>((block_size_ / frame_size) * block_count_);
+    req.tp_retire_blk_tov = config.immediate ? 1 : static_cast<unsigned>(config.block_timeout);
+    req.tp_sizeof_priv = 0;
+    req.tp_feature_req_word = 0;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        spdlog::error("failed to set up tpacket ring: {}", strerror(errno));
+        return;
+    }
+
+    ring_size = block_size_ * block_count_;
+    void* mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        spdlog::error("failed to map tpacket ring: {}", strerror(errno));
+        return;
+    }
+    ring = reinterpret_cast<uint8_t*>(mem);
+
+    // compiling even an empty filter yields a program that truncates to snaplen in the kernel
+    pcap_t* dead = pcap_open_dead(datalink_, config.snaplen);
+    if (dead == nullptr) {
+        spdlog::error("failed to prepare capture filter");
+        return;
+    }
+    bpf_program prog{};
+    if (pcap_compile(dead, &prog, config.filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) != 0) {
+        spdlog::error("failed to compile filter: {}", pcap_geterr(dead));
+        pcap_close(dead);
+        return;
+    }
+    sock_fprog fprog{
+        static_cast<unsigned short>(prog.bf_len),
+        reinterpret_cast<sock_filter*>(prog.bf_insns)
+    };
+    auto rc = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+    pcap_freecode(&prog);
+    pcap_close(dead);
+    if (rc < 0) {
+        spdlog::error("failed to apply filter: {}", strerror(errno));
+        return;
+    }
+
+    if (config.promisc) {
+        packet_mreq mreq{};
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            spdlog::error("failed to put interface {} in promiscuous mode: {}", config.iface, strerror(errno));
+            return;
+        }
+    }
+
+    sockaddr_ll addr{};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        spdlog::error("failed to bind to interface {}: {}", config.iface, strerror(errno));
+        return;
+    }
+
+    if (fanout_id >= 0) {
+        int fanout_arg = (fanout_id & 0xFFFF) | (fanout_type(config.fanout) << 16);
+        if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg)) < 0) {
+            spdlog::error("failed to join fanout group {}: {}", fanout_id, strerror(errno));
+            return;
+        }
+    }
+
+    std::swap(fd_, fd);
+    std::swap(ring_, ring);
+}
+
+TPacketRing::~TPacketRing() {
+    if (ring_ != nullptr) {
+        munmap(ring_, block_size_ * block_count_);
+        ring_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool TPacketRing::ok() const {
+    return fd_ >= 0;
+}
+
+int TPacketRing::fd() const {
+    return fd_;
+}
+
+int TPacketRing::datalink() const {
+    return datalink_;
+}
+
+int TPacketRing::poll_timeout() const {
+    // the kernel retires blocks on its own timer, so only stats need an earlier wake up, and the
+    // sniffer takes care of that
+    return -1;
+}
+
+uint64_t TPacketRing::last_timestamp() const {
+    return last_ts_.load(std::memory_order_relaxed);
+}
+
+void TPacketRing::write_block(Producer& producer, uint8_t* block) {
+    auto desc = reinterpret_cast<tpacket_block_desc*>(block);
+    auto pkt = block + desc->hdr.bh1.offset_to_first_pkt;
+    const auto num_pkts = desc->hdr.bh1.num_pkts;
+    uint64_t last_ts = 0;
+    for (uint32_t i = 0; i < num_pkts; ++i) {
+        auto hdr = reinterpret_cast<tpacket3_hdr*>(pkt);
+        const uint8_t* data = pkt + hdr->tp_mac;
+        uint32_t caplen = std::min(hdr->tp_snaplen, snaplen_);
+        uint32_t len = hdr->tp_len;
+
+        // the kernel strips offloaded VLAN tags, so put them back like libpcap does
+        if ((hdr->tp_status & TP_STATUS_VLAN_VALID) != 0 && datalink_ == DLT_EN10MB && caplen >= 12) {
+            uint16_t tpid = (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) != 0 ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+            uint16_t tag[2] = {htons(tpid), htons(static_cast<uint16_t>(hdr->hv1.tp_vlan_tci))};
+            scratch_.resize(caplen + sizeof(tag));
+            std::memcpy(scratch_.data(), data, 12);
+            std::memcpy(scratch_.data() + 12, tag, sizeof(tag));
+            std::memcpy(scratch_.data() + 12 + sizeof(tag), data + 12, caplen - 12);
+            data = scratch_.data();
+            caplen = std::min<uint32_t>(caplen + sizeof(tag), snaplen_);
+            len += sizeof(tag);
+        }
+
+        uint64_t frac = nano_ ? hdr->tp_nsec : hdr->tp_nsec / 1000;
+        producer.write_packet(hdr->tp_sec, frac, len, caplen, data);
+        last_ts = (static_cast<uint64_t>(hdr->tp_sec) * 1'000'000'000) + hdr->tp_nsec;
+
+        pkt += hdr->tp_next_offset;
+    }
+    if (num_pkts > 0) {
+        last_ts_.store(last_ts, std::memory_order_relaxed);
+    }
+}
+
+int TPacketRing::dispatch(Producer& producer) {
+    int blocks = 0;
+    for (;;) {
+        auto block = ring_ + (cur_block_ * block_size_);
+        auto desc = reinterpret_cast<tpacket_block_desc*>(block);
+        auto status = reinterpret_cast<std::atomic<uint32_t>*>(&desc->hdr.bh1.block_status);
+        if ((status->load(std::memory_order_acquire) & TP_STATUS_USER) == 0) {
+            break;
+        }
+        write_block(producer, block);
+        status->store(TP_STATUS_KERNEL, std::memory_order_release);
+        producer.flush();
+        cur_block_ = (cur_block_ + 1) % block_count_;
+        ++blocks;
+    }
+    return blocks;
+}
+
+bool TPacketRing::stats(uint64_t& recv, uint64_t& os_drops) {
+    tpacket_stats_v3 stats{};
+    socklen_t len = sizeof(stats);
+    if (getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0) {
+        spdlog::error("failed to collect capture statistics: {}", strerror(errno));
+        return false;
+    }
+    // the kernel resets these counters on every read
+    recv_ += stats.tp_packets;
+    os_drops_ += stats.tp_drops;
+    recv = recv_;
+    os_drops = os_drops_;
+    return true;
+}
@@ -0,0 +1,138 @@
+#include <fastcap/volume.hpp>
+#include <fastcap/utils.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+// enough to get past the disk's write cache without holding up the start of capture for long
+static constexpr size_t PROBE_LEN = 64 << 20;
+static constexpr size_t PROBE_CHUNK = 1 << 20;
+
+// write throughput of dir in MiB/s, 0 if it can't be told apart from the page cache's, or a
+// negative value if it can't be written to
+static double measure(const std::string& dir) {
+    auto path = (std::filesystem::path(dir) / ".fastcap-probe-XXXXXX").string();
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        spdlog::error("failed to write to volume {}: {}", dir, strerror(errno));
+        return -1.0;
+    }
+    auto guard = finally([&] {
+        ::close(fd);
+        unlink(path.c_str());
+    });
+    // the page cache would make every volume look as fast as memory
+    const auto flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) < 0) {
+        spdlog::warn("volume {} does not support O_DIRECT, its write speed can't be measured: {}", dir, strerror(errno));
+        return 0.0;
+    }
+
+    void* chunk = nullptr;
+    if (posix_memalign(&chunk, 4096, PROBE_CHUNK) != 0) {
+        return -1.0;
+    }
+    auto chunk_guard = finally([&] { free(chunk); });
+    std::memset(chunk, 0xA5, PROBE_CHUNK);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t written = 0; written < PROBE_LEN; written += PROBE_CHUNK) {
+        if (write(fd, chunk, PROBE_CHUNK) != static_cast<ssize_t>(PROBE_CHUNK)) {
+            spdlog::error("failed to write to volume {}: {}", dir, strerror(errno));
+            return -1.0;
+        }
+    }
+    fdatasync(fd);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(PROBE_LEN >> 20) / std::max(elapsed.count(), 1e-6);
+}
+
+bool plan_volumes(const Config& config, std::vector<Volume>& volumes) {
+    volumes.clear();
+    std::vector<size_t> probed;
+    bool unmeasured = false;
+    for (const auto& spec : config.volumes) {
+        Volume volume;
+        volume.dir = spec;
+        bool measured = true;
+        // a trailing :WEIGHT is only taken as one if it parses, so directories may contain ':'
+        auto colon = spec.rfind(':');
+        if (colon != std::string::npos) {
+            char* end = nullptr;
+            const auto weight = std::strtod(spec.c_str() + colon + 1, &end);
+            if (end != spec.c_str() + colon + 1 && *end == '\0') {
+                if (!(weight > 0.0)) {
+                    spdlog::error("invalid volume weight: {}", spec);
+                    return false;
+                }
+                volume.dir = spec.substr(0, colon);
+                volume.weight = weight;
+                measured = false;
+            }
+        }
+        std::error_code ec;
+        if (!std::filesystem::is_directory(volume.dir, ec)) {
+            spdlog::error("volume {} is not a directory", volume.dir);
+            return false;
+        }
+        if (measured) {
+            volume.weight = measure(volume.dir);
+            if (volume.weight < 0.0) {
+                return false;
+            }
+            if (volume.weight > 0.0) {
+                spdlog::info("volume {} writes at {:.0f} MiB/s", volume.dir, volume.weight);
+            } else {
+                unmeasured = true;
+            }
+            probed.push_back(volumes.size());
+        }
+        volumes.push_back(std::move(volume));
+    }
+    if (unmeasured) {
+        // one unknown speed makes the others meaningless to compare against
+        spdlog::warn("weighing volumes without a :WEIGHT equally");
+        for (auto i : probed) {
+            volumes[i].weight = 1.0;
+        }
+    }
+    return true;
+}
+
+std::vector<size_t> assign_files(const std::vector<Volume>& volumes, size_t file_count, bool weighted_files) {
+    std::vector<size_t> assignment(file_count);
+    if (weighted_files) {
+        for (size_t i = 0; i < file_count; ++i) {
+            assignment[i] = i % volumes.size();
+        }
+        return assignment;
+    }
+    // each file goes to the volume with the least files for its weight, so they interleave
+    std::vector<size_t> counts(volumes.size(), 0);
+    for (size_t i = 0; i < file_count; ++i) {
+        size_t best = i < volumes.size() ? i : 0;
+        if (i >= volumes.size()) {
+            for (size_t v = 1; v < volumes.size(); ++v) {
+                if (static_cast<double>(counts[v] + 1) / volumes[v].weight < static_cast<double>(counts[best] + 1) / volumes[best].weight) {
+                    best = v;
+                }
+            }
+        }
+        ++counts[best];
+        assignment[i] = best;
+    }
+    for (size_t v = 0; v < volumes.size(); ++v) {
+        spdlog::info("volume {} gets {} of {} files", volumes[v].dir, counts[v], file_count);
+    }
+    return assignment;
+}
@@ -1,146 +1,697 @@
 #include <fastcap/writer.hpp>
+#include <fastcap/block.hpp>
 #include <fastcap/sysinfo.hpp>
 #include <fastcap/device.hpp>
+#include <fastcap/output.hpp>
+#include <fastcap/pcapng.hpp>
+#include <fastcap/xdp.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstring>
 #include <filesystem>
 #include <spdlog/fmt/fmt.h>
 #include <pcap.h>
 #include <spdlog/spdlog.h>
 
-void write(std::ofstream& f, const void* data, std::streamsize len) {
-    f.write(reinterpret_cast<const char*>(data), len);
+#include <sys/uio.h>
+
+static void write(std::vector<uint8_t>& f, const void* data, size_t len) {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    f.insert(f.end(), bytes, bytes + len);
+}
+
+WriterSet::WriterSet(const Config& config, const Placement& placement, const std::vector<Volume>& volumes)
+    : config_(config),
+      placement_(placement),
+      volumes_(volumes) {
+    // each writer drains a single producer so that entry IDs stay ordered within every file,
+    // writer i belongs to producer i % producer_count
+    const auto producer_count = static_cast<size_t>(config.capture_threads);
+    auto capacity = static_cast<size_t>(config.bufsz) / producer_count;
+    if (config.backend == "xdp") {
+        // packet data stays in the UMEM, so the ring only needs room for one reference per frame
+        const auto frames = capacity / static_cast<size_t>(config.xdp_frame_size);
+        capacity = 2 * frames * (sizeof(size_t) + sizeof(StatHdr));
+    }
+    producers_.reserve(producer_count);
+    for (size_t i = 0; i < producer_count; ++i) {
+        size_t shards = 1;
+        if (config.pipeline == "sharded") {
+            shards = (static_cast<size_t>(config.num_files) - i + producer_count - 1) / producer_count;
+        }
+        producers_.push_back(std::make_unique<Producer>(*this, config, capacity / shards, shards, placement.node));
+        for (const auto& ring : producers_.back()->rings_) {
+            if (!ring->ok()) {
+                producers_.clear();
+                return;
+            }
+        }
+    }
+
+    if (config.pipeline == "sharded" && !volumes_.empty()) {
+        // runs are scaled so that they still average --shard-run within each producer
+        for (size_t i = 0; i < producer_count; ++i) {
+            auto& runs = producers_[i]->shard_runs_;
+            double total = 0.0;
+            for (size_t j = 0; j < runs.size(); ++j) {
+                total += volumes_[(i + (j * producer_count)) % volumes_.size()].weight;
+            }
+            for (size_t j = 0; j < runs.size(); ++j) {
+                const auto weight = volumes_[(i + (j * producer_count)) % volumes_.size()].weight;
+                const auto run = static_cast<double>(config.shard_run) * static_cast<double>(runs.size()) * weight / total;
+                runs[j] = static_cast<uint32_t>(std::max(1.0, run + 0.5));
+            }
+            producers_[i]->run_left_ = runs.front();
+        }
+    }
+}
+
+WriterSet::~WriterSet() = default;
+
+RingBuffer& WriterSet::writer_ring(size_t idx) {
+    auto& producer = *producers_[idx % producers_.size()];
+    return *producer.rings_[(idx / producers_.size()) % producer.rings_.size()];
+}
+
+void WriterSet::log_occupancy() const {
+    std::string occupancy;
+    for (const auto& producer : producers_) {
+        for (const auto& ring : producer->rings_) {
+            occupancy += fmt::format("{}{:.1f}%", occupancy.empty() ? "" : ", ", 100.0 * ring->occupancy());
+        }
+    }
+    spdlog::info("buffer occupancy: {}", occupancy);
 }
 
-WriterSet::WriterSet(const Config& config, int datalink) : buf_(config.bufsz) {
+void WriterSet::start(int datalink) {
+    const auto& config = config_;
+    const auto producer_count = producers_.size();
+    std::vector<std::string> paths;
     if (config.num_files == 1) {
-        writers_.emplace_back(*this, std::ofstream(config.fname, std::ios::binary));
+        paths.push_back(config.fname);
     } else {
-        writers_.reserve(config.num_files);
         auto ext = std::filesystem::path(config.fname).extension().string();
         auto fname = config.fname.substr(0, config.fname.size() - ext.size());
         for (int i = 0; i < config.num_files; ++i) {
-            writers_.emplace_back(*this, std::ofstream(fmt::format("{}.{}{}", fname, i, ext)));
+            paths.push_back(fmt::format("{}.{}{}", fname, i, ext));
         }
     }
-
-    const uint32_t magic = 0x46434150;
-    for (auto& writer : writers_) {
-        write(writer.file_, &magic, sizeof(magic));
+    if (!volumes_.empty()) {
+        // sharded writers are weighted by their runs, shared ones by how many of them there are
+        const auto assignment = assign_files(volumes_, paths.size(), config.pipeline == "sharded");
+        for (size_t i = 0; i < paths.size(); ++i) {
+            const auto& dir = volumes_[assignment[i]].dir;
+            paths[i] = (std::filesystem::path(dir) / std::filesystem::path(paths[i]).filename()).string();
+        }
     }
 
-    auto& f = writers_.front().file_;
-    uint64_t entry_id = 0;
-    write(f, &entry_id, sizeof(entry_id));
-    auto cpu = cpu_model();
-    auto os = os_version();
+    PcapNGInfo info;
     auto dev = Device{config.iface};
-    write(f, cpu.c_str(), cpu.size() + 1);
-    write(f, os.c_str(), os.size() + 1);
-    auto name = dev.name();
-    write(f, name.c_str(), name.size() + 1);
-    uint8_t nano = config.nano ? 1 : 0;
-    write(f, &nano, 1);
-    write(f, config.filter.c_str(), config.filter.size() + 1);
-    write(f, &config.snaplen, sizeof(int));
-    auto ipv4s = dev.ipv4_addrs();
-    auto ipv4_count = static_cast<uint32_t>(ipv4s.size());
-    write(f, &ipv4_count, sizeof(ipv4_count));
-    for (const auto& ipv4 : ipv4s) {
-        write(f, ipv4.addr.data(), 4);
-        write(f, ipv4.mask.data(), 4);
-    }
-    auto ipv6s = dev.ipv6_addrs();
-    auto ipv6_count = static_cast<uint32_t>(ipv6s.size());
-    write(f, &ipv6_count, sizeof(ipv6_count));
-    for (const auto& ipv6 : ipv6s) {
-        write(f, ipv6.addr.data(), 16);
-        write(f, &ipv6.prefix_len, 1);
-    }
-    auto mac = dev.mac_addr();
-    if (mac) {
-        uint8_t has_mac = 0;
-        write(f, &has_mac, 1);
+    info.cpu_model = cpu_model();
+    info.os_version = os_version();
+    info.dev_name = dev.name();
+    info.nano = config.nano;
+    info.filter = config.filter;
+    info.snaplen = config.snaplen;
+    info.ipv4s = dev.ipv4_addrs();
+    info.ipv6s = dev.ipv6_addrs();
+    info.mac = dev.mac_addr();
+    info.hardware = dev.hardware();
+    info.speed = dev.speed();
+    info.link = static_cast<uint16_t>(datalink);
+
+    // f is what the first file starts with, the others only get its first header_len bytes
+    std::vector<uint8_t> f;
+    size_t header_len = 0;
+    if (config.format == "pcapng") {
+        // every file is a section of its own, with the packets in the order that file got them
+        append_shb(f, info);
+        append_idb(f, info);
+        header_len = f.size();
+        pcapng_ = std::make_unique<PcapNGInfo>(std::move(info));
     } else {
-        uint8_t has_mac = 1;
+        const uint32_t magic = MAGIC_V2;
+        write(f, &magic, sizeof(magic));
+        header_len = f.size();
+
+        uint64_t entry_id = 0;
+        write(f, &entry_id, sizeof(entry_id));
+        write(f, info.cpu_model.c_str(), info.cpu_model.size() + 1);
+        write(f, info.os_version.c_str(), info.os_version.size() + 1);
+        write(f, info.dev_name.c_str(), info.dev_name.size() + 1);
+        uint8_t nano = info.nano ? 1 : 0;
+        write(f, &nano, 1);
+        write(f, info.filter.c_str(), info.filter.size() + 1);
+        write(f, &info.snaplen, sizeof(int));
+        auto ipv4_count = static_cast<uint32_t>(info.ipv4s.size());
+        write(f, &ipv4_count, sizeof(ipv4_count));
+        for (const auto& ipv4 : info.ipv4s) {
+            write(f, ipv4.addr.data(), 4);
+            write(f, ipv4.mask.data(), 4);
+        }
+        auto ipv6_count = static_cast<uint32_t>(info.ipv6s.size());
+        write(f, &ipv6_count, sizeof(ipv6_count));
+        for (const auto& ipv6 : info.ipv6s) {
+            write(f, ipv6.addr.data(), 16);
+            write(f, &ipv6.prefix_len, 1);
+        }
+        uint8_t has_mac = info.mac.has_value() ? 1 : 0;
         write(f, &has_mac, 1);
-        write(f, mac->data(), 6);
+        if (info.mac) {
+            write(f, info.mac->data(), 6);
+        }
+        write(f, info.hardware.c_str(), info.hardware.size() + 1);
+        write(f, &info.speed, sizeof(info.speed));
+        write(f, &info.link, sizeof(info.link));
+    }
+
+    if (config.dedup_window > 0) {
+        for (auto& producer : producers_) {
+            producer->dedup_ = std::make_unique<Deduplicator>(datalink, static_cast<uint64_t>(config.dedup_window), config.nano);
+        }
+    }
+    if (config.overflow == "truncate") {
+        truncator_ = std::make_unique<Slicer>(datalink, 0);
+        for (auto& producer : producers_) {
+            producer->truncator_ = truncator_.get();
+        }
+    }
+    if (config.slice >= 0) {
+        slicer_ = std::make_unique<Slicer>(datalink, static_cast<uint32_t>(config.slice));
+        for (auto& producer : producers_) {
+            producer->slicer_ = slicer_.get();
+        }
+    }
+
+    // rotated segments each start with the full header, so a fastcap lead is in every one
+    if (config.rotate_size > 0 || config.rotate_interval > 0) {
+        rotator_ = std::make_unique<SegmentRotator>(config, placement_.node, paths, f);
+    }
+    writers_.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        writers_.emplace_back(*this, *producers_[i % producer_count], writer_ring(i), i, paths[i]);
+    }
+    if (rotator_ == nullptr) {
+        for (size_t i = 0; i < writers_.size(); ++i) {
+            iovec iov{f.data(), i == 0 ? f.size() : header_len};
+            writers_[i].out_->write(&iov, 1);
+        }
     }
-    auto hw = dev.hardware();
-    write(f, hw.c_str(), hw.size() + 1);
-    auto speed = dev.speed();
-    write(f, &speed, sizeof(speed));
-    auto link = static_cast<uint16_t>(datalink);
-    write(f, &link, sizeof(link));
 
     ++entry_count_;
 
-    for (auto& writer : writers_) {
-        writer.launch_worker();
+    if (rotator_ != nullptr) {
+        rotator_->start();
+    }
+    for (size_t i = 0; i < writers_.size(); ++i) {
+        writers_[i].launch_worker(Placement::cpu(placement_.writer_cpus, i));
     }
 }
 
-void WriterSet::write_packet(const pcap_pkthdr& hdr, const uint8_t* bytes) {
-    if (buf_.prepare_write(sizeof(PktHdr) + hdr.caplen)) {
-        PktHdr phdr {
-            entry_count_,
-            static_cast<uint64_t>(hdr.ts.tv_sec),
-            static_cast<uint64_t>(hdr.ts.tv_usec),
-            hdr.len,
-            hdr.caplen
-        };
-        buf_.write_some(reinterpret_cast<uint8_t*>(&phdr), sizeof(PktHdr));
-        buf_.write_some(bytes, phdr.caplen);
-        buf_.commit_write();
-        ++entry_count_;
-    }
+bool WriterSet::ok() const {
+    return !producers_.empty();
 }
 
-void WriterSet::write_stats(const timeval& ts, uint64_t recv, uint64_t iface_drops, uint64_t os_drops) {
-    if (buf_.prepare_write(sizeof(StatHdr))) {
-        StatHdr hdr {
-            entry_count_ | (1ull << 63),
-            static_cast<uint64_t>(ts.tv_sec),
-            static_cast<uint64_t>(ts.tv_usec),
-            recv,
-            iface_drops,
-            os_drops
-        };
-        buf_.write_some(reinterpret_cast<uint8_t*>(&hdr), sizeof(StatHdr));
-        buf_.commit_write();
-        ++entry_count_;
+size_t WriterSet::producer_count() const {
+    return producers_.size();
+}
 
-        spdlog::info("received: {}, interface dropped: {}, OS dropped: {}", hdr.recv, hdr.iface_drops, hdr.os_drops);
-    }
+Producer& WriterSet::producer(size_t idx) {
+    return *producers_[idx];
 }
 
 int WriterSet::join() {
+    // spilled entries still have to reach the writers before they are told to stop
+    for (auto& producer : producers_) {
+        producer->drain();
+    }
     stop_.store(true, std::memory_order_relaxed);
-    buf_.notify_all_consumers();
+    for (auto& producer : producers_) {
+        for (auto& ring : producer->rings_) {
+            ring->notify_all_consumers();
+        }
+    }
     for (auto& writer : writers_) {
         writer.join();
     }
+    if (rotator_ != nullptr) {
+        rotator_->stop();
+    }
     return 0;
 }
 
-Writer::Writer(WriterSet& set, std::ofstream file)
-    : file_(std::move(file)),
-      set_(&set) {
+Producer::Producer(WriterSet& set, const Config& config, size_t capacity, size_t shards, int node)
+    : set_(&set),
+      shard_runs_(shards, static_cast<uint32_t>(config.shard_run)),
+      run_left_(static_cast<uint32_t>(config.shard_run)) {
+    const bool single_consumer = config.pipeline == "sharded";
+    for (size_t i = 0; i < shards; ++i) {
+        rings_.push_back(std::make_unique<RingBuffer>(capacity, config, node, single_consumer));
+    }
+    buf_ = rings_.front().get();
+    staged_.reserve(1024);
+    if (config.overflow == "spill") {
+        spill_.resize(static_cast<size_t>(config.spill_size) << 20);
+    }
+}
+
+void Producer::next_shard() {
+    shard_ = (shard_ + 1) % rings_.size();
+    buf_ = rings_[shard_].get();
+    run_left_ = shard_runs_[shard_];
+}
+
+uint8_t* Producer::ring_entry(size_t num_bytes, uint64_t flags) {
+    if (run_left_ == 0) {
+        next_shard();
+    }
+    // a shard whose writer has fallen behind is skipped rather than dropping the entry
+    for (size_t i = 0; i < rings_.size(); ++i) {
+        auto entry = buf_->prepare_write(num_bytes);
+        if (entry != nullptr) {
+            // the ID is filled in by flush, so a burst only touches the shared entry counter once
+            staged_.emplace_back(entry, flags);
+            --run_left_;
+            return entry;
+        }
+        next_shard();
+    }
+    return nullptr;
 }
 
+bool Producer::spill_entry(size_t num_bytes, uint64_t flags) {
+    // spilled entries are the entry's length and flags followed by its data, 8 byte aligned
+    const auto needed = 2 * sizeof(uint64_t) + ((num_bytes + 7) & ~size_t{7});
+    if (spill_tail_ + needed > spill_.size()) {
+        if (spill_tail_ - spill_head_ + needed > spill_.size()) {
+            return false;
+        }
+        std::memmove(spill_.data(), spill_.data() + spill_head_, spill_tail_ - spill_head_);
+        spill_tail_ -= spill_head_;
+        spill_head_ = 0;
+    }
+    const uint64_t hdr[2] = {num_bytes, flags};
+    std::memcpy(spill_.data() + spill_tail_, hdr, sizeof(hdr));
+    spill_ptr_ = spill_.data() + spill_tail_ + 2 * sizeof(uint64_t);
+    spill_tail_ += needed;
+    spill_used_.store(spill_tail_ - spill_head_, std::memory_order_relaxed);
+    return true;
+}
+
+void Producer::drain_spill() {
+    while (spill_head_ != spill_tail_) {
+        uint64_t hdr[2];
+        std::memcpy(hdr, spill_.data() + spill_head_, sizeof(hdr));
+        const auto len = static_cast<size_t>(hdr[0]);
+        if (ring_entry(len, hdr[1]) == nullptr) {
+            spill_used_.store(spill_tail_ - spill_head_, std::memory_order_relaxed);
+            return;
+        }
+        buf_->write_some(spill_.data() + spill_head_ + sizeof(hdr), len);
+        buf_->commit_write();
+        spill_head_ += sizeof(hdr) + ((len + 7) & ~size_t{7});
+    }
+    spill_head_ = 0;
+    spill_tail_ = 0;
+    spill_used_.store(0, std::memory_order_relaxed);
+}
+
+bool Producer::prepare(size_t num_bytes, uint64_t flags) {
+    spill_ptr_ = nullptr;
+    // newer entries queue up behind spilled ones so that the writers still get them in order
+    drain_spill();
+    if (spill_head_ == spill_tail_) {
+        if (ring_entry(num_bytes, flags) != nullptr) {
+            return true;
+        }
+        // let writers start on what is already staged before giving up on the rings
+        flush();
+        if (ring_entry(num_bytes, flags) != nullptr) {
+            return true;
+        }
+    }
+    return !spill_.empty() && spill_entry(num_bytes, flags);
+}
+
+void Producer::put(const void* buf, size_t len) {
+    if (spill_ptr_ != nullptr) {
+        std::memcpy(spill_ptr_, buf, len);
+        spill_ptr_ += len;
+    } else {
+        buf_->write_some(buf, len);
+    }
+}
+
+void Producer::commit() {
+    if (spill_ptr_ == nullptr) {
+        buf_->commit_write();
+    }
+    spill_ptr_ = nullptr;
+}
+
+void Producer::write_packet(const pcap_pkthdr& hdr, const uint8_t* bytes) {
+    write_packet(
+        static_cast<uint64_t>(hdr.ts.tv_sec),
+        static_cast<uint64_t>(hdr.ts.tv_usec),
+        hdr.len,
+        hdr.caplen,
+        bytes
+    );
+}
+
+void Producer::write_packet(uint64_t secs, uint64_t frac, uint32_t len, uint32_t caplen, const uint8_t* bytes) {
+    if (dedup_ != nullptr && dedup_->duplicate(secs, frac, len, bytes, caplen)) {
+        return;
+    }
+    if (slicer_ != nullptr) {
+        caplen = slicer_->slice(bytes, caplen);
+    }
+    if (!prepare(sizeof(PktHdr) + caplen, 0)) {
+        // with --overflow truncate the headers may still fit where the whole packet didn't
+        const auto hdr_len = truncator_ != nullptr ? truncator_->slice(bytes, caplen) : caplen;
+        if (hdr_len == caplen || !prepare(sizeof(PktHdr) + hdr_len, 0)) {
+            queue_drops_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        caplen = hdr_len;
+        truncated_.fetch_add(1, std::memory_order_relaxed);
+    }
+    PktHdr phdr {
+        0,
+        secs,
+        frac,
+        len,
+        caplen
+    };
+    put(&phdr, sizeof(PktHdr));
+    put(bytes, phdr.caplen);
+    commit();
+}
+
+void Producer::set_umem(Umem* umem) {
+    umem_ = umem;
+}
+
+bool Producer::write_frame(uint64_t secs, uint64_t frac, uint32_t len, uint32_t caplen, uint64_t addr) {
+    if (dedup_ != nullptr && dedup_->duplicate(secs, frac, len, umem_->frame(addr), caplen)) {
+        return false;
+    }
+    if (slicer_ != nullptr) {
+        caplen = slicer_->slice(umem_->frame(addr), caplen);
+    }
+    if (!prepare(sizeof(PktHdr) + sizeof(uint64_t), 0)) {
+        queue_drops_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    PktHdr phdr {
+        0,
+        secs,
+        frac,
+        len,
+        caplen
+    };
+    put(&phdr, sizeof(PktHdr));
+    put(&addr, sizeof(uint64_t));
+    commit();
+    return true;
+}
+
+void Producer::write_stats(const timeval& ts, uint64_t recv, uint64_t iface_drops, uint64_t os_drops) {
+    // one capture thread writes the stats for all of them, so the counts cover every producer
+    uint64_t suppressed = 0;
+    uint64_t queue_drops = 0;
+    uint64_t truncated = 0;
+    double spill_fill = 0.0;
+    for (const auto& producer : set_->producers_) {
+        if (producer->dedup_ != nullptr) {
+            suppressed += producer->dedup_->suppressed();
+        }
+        queue_drops += producer->queue_drops_.load(std::memory_order_relaxed);
+        truncated += producer->truncated_.load(std::memory_order_relaxed);
+        if (!producer->spill_.empty()) {
+            const auto fill = static_cast<double>(producer->spill_used_.load(std::memory_order_relaxed)) / static_cast<double>(producer->spill_.size());
+            spill_fill = std::max(spill_fill, fill);
+        }
+    }
+    StatHdr hdr {
+        0,
+        static_cast<uint64_t>(ts.tv_sec),
+        static_cast<uint64_t>(ts.tv_usec),
+        recv,
+        iface_drops,
+        os_drops,
+        suppressed,
+        queue_drops
+    };
+    if (prepare(sizeof(StatHdr), 1ull << 63)) {
+        put(&hdr, sizeof(StatHdr));
+        commit();
+    }
+
+    // logged even when the entry itself didn't fit, since that is when the counts matter most
+    auto counts = fmt::format("received: {}, interface dropped: {}, OS dropped: {}, queue dropped: {}", hdr.recv, hdr.iface_drops, hdr.os_drops, hdr.queue_drops);
+    if (dedup_ != nullptr) {
+        counts += fmt::format(", duplicates suppressed: {}", hdr.suppressed);
+    }
+    if (truncator_ != nullptr) {
+        counts += fmt::format(", truncated: {}", truncated);
+    }
+    if (!spill_.empty()) {
+        // the fullest of the capture threads' spill buffers
+        counts += fmt::format(", spill buffer: {:.1f}%", 100.0 * spill_fill);
+    }
+    spdlog::info("{}", counts);
+    set_->log_occupancy();
+}
+
+void Producer::flush() {
+    drain_spill();
+    if (staged_.empty()) {
+        return;
+    }
+    auto entry_id = set_->entry_count_.fetch_add(staged_.size(), std::memory_order_relaxed);
+    for (const auto& [entry, flags] : staged_) {
+        const auto id = entry_id | flags;
+        std::memcpy(entry, &id, sizeof(id));
+        ++entry_id;
+    }
+    staged_.clear();
+    for (auto& ring : rings_) {
+        ring->publish();
+    }
+}
+
+void Producer::drain() {
+    flush();
+    while (spill_head_ != spill_tail_) {
+        std::this_thread::yield();
+        flush();
+    }
+}
+
+Writer::Writer(WriterSet& set, Producer& producer, RingBuffer& buf, size_t idx, const std::string& path)
+    : out_(set.rotator_ != nullptr ? set.rotator_->first(idx) : std::make_unique<OutputFile>(path, set.config_, set.placement_.node)),
+      set_(&set),
+      producer_(&producer),
+      buf_(&buf),
+      idx_(idx) {}
+
 void Writer::work() {
-    std::vector<uint8_t> buf;
-    buf.reserve(1600);
-    while (set_->buf_.try_read_while([this] {
+    // entries are copied into the output file's staging block straight out of the ring, a block
+    // left partly filled is written once no more entries arrive for --flush-timeout
+    constexpr size_t MAX_CLAIM = 1 << 20;
+    const auto& config = set_->config_;
+    const auto flush_timeout = std::chrono::milliseconds(config.flush_timeout);
+    const auto rotate_size = static_cast<uint64_t>(config.rotate_size) << 20;
+    const auto rotate_interval = std::chrono::seconds(config.rotate_interval);
+    auto rotate_at = std::chrono::steady_clock::now() + rotate_interval;
+    auto rotator = set_->rotator_.get();
+    // with --format pcapng entries are written as EPBs and ISBs instead
+    auto info = set_->pcapng_.get();
+    constexpr size_t META_SLOT = ISB_LEN;
+    static_assert(EPB_HEADER_LEN + EPB_TRAILER_MAX_LEN <= META_SLOT);
+    std::vector<uint8_t> meta;
+    // the fastcap format wraps every span in a block, see block.hpp
+    const uint64_t frac_scale = config.nano ? 1 : 1000;
+    const bool compact = info == nullptr && config.entry_format == "compact";
+    static_assert(COMPACT_MAX_LEN <= META_SLOT);
+    uint64_t prev_id = 0;
+    uint64_t prev_ts = 0;
+    BlockHdr block{};
+    BlockFtr footer{};
+    std::vector<iovec> iov;
+    std::vector<uint64_t> frames;
+    RingSpan span;
+    auto& buf = *buf_;
+    auto running = [this] {
         return !set_->stop_.load(std::memory_order_relaxed);
-    }, buf)) {
-        file_.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    };
+    while (true) {
+        if (rotator != nullptr) {
+            // rotation is only checked between spans, a segment that is not ready yet is retried
+            // on the next pass rather than waited for
+            const auto now = std::chrono::steady_clock::now();
+            if (((rotate_size > 0 && out_->size() >= rotate_size) || (rotate_interval.count() > 0 && now >= rotate_at))
+                && rotator->rotate(idx_, out_)) {
+                rotate_at = now + rotate_interval;
+            }
+        }
+        // don't claim past the end of a size limited segment
+        auto max_claim = MAX_CLAIM;
+        if (rotate_size > 0 && out_->size() < rotate_size) {
+            max_claim = static_cast<size_t>(std::min<uint64_t>(max_claim, rotate_size - out_->size()));
+        }
+        if (out_->pending()) {
+            if (!buf.try_claim_for(running, span, max_claim, flush_timeout)) {
+                out_->flush();
+                if (!running()) {
+                    break;
+                }
+                continue;
+            }
+        } else if (!buf.try_claim_while(running, span, max_claim)) {
+            break;
+        }
+        auto umem = producer_->umem_;
+        iov.clear();
+        frames.clear();
+        if (info != nullptr || compact) {
+            // PCAPNG framing and compact entry headers go into one meta slot per entry, so meta
+            // must not move under iov
+            size_t entries = 0;
+            buf.for_each_entry(span, [&](uint8_t*, size_t) { ++entries; });
+            meta.resize(entries * META_SLOT);
+        }
+        auto next_meta = meta.data();
+        if (info == nullptr) {
+            block = BlockHdr{};
+            block.sync = BLOCK_SYNC;
+            block.flags = (compact ? BLOCK_COMPACT : 0) | (config.nano ? BLOCK_NANO : 0);
+            iov.push_back({&block, sizeof(block)});
+        }
+        buf.for_each_entry(span, [&](uint8_t* data, size_t len) {
+            uint64_t entry_id = 0;
+            std::memcpy(&entry_id, data, sizeof(entry_id));
+            if (info == nullptr) {
+                // packet and stats entries both start with the ID, seconds and fraction
+                uint64_t ts[2];
+                std::memcpy(ts, data + sizeof(entry_id), sizeof(ts));
+                const auto id = entry_id & ~(1ull << 63);
+                const auto ns = (ts[0] * 1'000'000'000) + (ts[1] * frac_scale);
+                if (block.count == 0) {
+                    block.first_id = id;
+                    block.first_ts = ns;
+                    prev_id = id;
+                    prev_ts = ns;
+                }
+                block.last_id = id;
+                block.last_ts = ns;
+                ++block.count;
+                if (compact) {
+                    const bool stats = (entry_id & (1ull << 63)) != 0;
+                    PktHdr phdr{};
+                    if (!stats) {
+                        std::memcpy(&phdr, data, sizeof(phdr));
+                    }
+                    auto p = next_meta;
+                    const uint64_t tag = ((id - prev_id) << 2) | (stats ? 2 : 0) | (!stats && phdr.len != phdr.caplen ? 1 : 0);
+                    p += put_varint(p, tag);
+                    p += put_varint(p, zigzag(static_cast<int64_t>(ns - prev_ts)));
+                    prev_id = id;
+                    prev_ts = ns;
+                    if (stats) {
+                        StatHdr hdr;
+                        std::memcpy(&hdr, data, sizeof(hdr));
+                        for (auto count : {hdr.recv, hdr.iface_drops, hdr.os_drops, hdr.suppressed, hdr.queue_drops}) {
+                            p += put_varint(p, count);
+                        }
+                        iov.push_back({next_meta, static_cast<size_t>(p - next_meta)});
+                        next_meta += META_SLOT;
+                        return;
+                    }
+                    p += put_varint(p, phdr.caplen);
+                    if ((tag & 1) != 0) {
+                        p += put_varint(p, phdr.len);
+                    }
+                    iov.push_back({next_meta, static_cast<size_t>(p - next_meta)});
+                    next_meta += META_SLOT;
+                    auto pkt = data + sizeof(PktHdr);
+                    if (umem != nullptr) {
+                        uint64_t addr = 0;
+                        std::memcpy(&addr, pkt, sizeof(addr));
+                        pkt = const_cast<uint8_t*>(umem->frame(addr));
+                        frames.push_back(addr);
+                    }
+                    iov.push_back({pkt, phdr.caplen});
+                    return;
+                }
+            }
+            if ((entry_id & (1ull << 63)) != 0) {
+                if (info != nullptr) {
+                    StatHdr hdr;
+                    std::memcpy(&hdr, data, sizeof(hdr));
+                    encode_isb(next_meta, *info, hdr);
+                    iov.push_back({next_meta, ISB_LEN});
+                    next_meta += META_SLOT;
+                } else {
+                    iov.push_back({data, len});
+                }
+                return;
+            }
+            PktHdr hdr;
+            std::memcpy(&hdr, data, sizeof(hdr));
+            auto pkt = data + sizeof(PktHdr);
+            if (umem != nullptr) {
+                // only the header lives in the ring, the packet data comes from the frame
+                uint64_t addr = 0;
+                std::memcpy(&addr, pkt, sizeof(addr));
+                pkt = const_cast<uint8_t*>(umem->frame(addr));
+                frames.push_back(addr);
+            }
+            if (info != nullptr) {
+                encode_epb_header(next_meta, *info, hdr.secs, hdr.frac, hdr.len, hdr.caplen);
+                iov.push_back({next_meta, EPB_HEADER_LEN});
+                iov.push_back({pkt, hdr.caplen});
+                auto trailer = next_meta + EPB_HEADER_LEN;
+                iov.push_back({trailer, encode_epb_trailer(trailer, hdr.caplen)});
+                next_meta += META_SLOT;
+            } else if (umem != nullptr) {
+                iov.push_back({data, sizeof(PktHdr)});
+                iov.push_back({pkt, hdr.caplen});
+            } else {
+                iov.push_back({data, len});
+            }
+        });
+        if (info == nullptr) {
+            uint32_t crc = 0;
+            for (size_t i = 1; i < iov.size(); ++i) {
+                crc = crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+                block.len += iov[i].iov_len;
+            }
+            block.crc = crc;
+            block.hdr_crc = crc32c(0, &block, offsetof(BlockHdr, hdr_crc));
+            footer.block_len = sizeof(block) + block.len + sizeof(footer);
+            footer.end = BLOCK_END;
+            iov.push_back({&footer, sizeof(footer)});
+            out_->checkpoint(block.first_id, block.first_ts);
+        }
+        out_->write(iov.data(), iov.size());
+        for (auto addr : frames) {
+            umem->release(addr);
+        }
+        buf.release(span);
     }
 }
 
-void Writer::launch_worker() {
-    worker_ = std::thread([this] { work(); });
+void Writer::launch_worker(int cpu) {
+    worker_ = std::thread([this, cpu] {
+        pin_thread(cpu);
+        work();
+    });
 }
 
 void Writer::join() {
     worker_.join();
+    out_->close();
 }
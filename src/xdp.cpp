@@ -0,0 +1,409 @@
+#include <fastcap/xdp.hpp>
+#include <fastcap/memory.hpp>
+#include <fastcap/utils.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+static int bpf(int cmd, bpf_attr& attr) {
+    return static_cast<int>(syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+}
+
+Umem::Umem(size_t frame_size, size_t frame_count, const Config& config, int node)
+    : frame_size_(frame_size),
+      frame_count_(frame_count),
+      map_size_(frame_size * frame_count),
+      released_(std::make_unique<std::atomic<uint8_t>[]>(frame_count)) {
+    mem_ = reinterpret_cast<uint8_t*>(map_buffer(map_size_, config, node));
+    if (mem_ == nullptr) {
+        spdlog::error("failed to allocate AF_XDP frame memory");
+    }
+}
+
+Umem::~Umem() {
+    unmap_buffer(mem_, map_size_);
+    mem_ = nullptr;
+}
+
+bool Umem::ok() const {
+    return mem_ != nullptr;
+}
+
+uint8_t* Umem::data() const {
+    return mem_;
+}
+
+size_t Umem::size() const {
+    return frame_size_ * frame_count_;
+}
+
+size_t Umem::frame_size() const {
+    return frame_size_;
+}
+
+size_t Umem::frame_count() const {
+    return frame_count_;
+}
+
+const uint8_t* Umem::frame(uint64_t addr) const {
+    return mem_ + addr;
+}
+
+void Umem::release(uint64_t addr) {
+    released_[addr / frame_size_].store(1, std::memory_order_release);
+}
+
+bool Umem::reclaim(uint64_t addr) {
+    auto& released = released_[addr / frame_size_];
+    if (released.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    released.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+XdpProgram::XdpProgram(const Config& config, int ifindex, size_t queue_count) {
+    int map_fd = -1;
+    int prog_fd = -1;
+    int link_fd = -1;
+    int promisc_fd = -1;
+    auto guard = finally([&map_fd, &prog_fd, &link_fd, &promisc_fd] {
+        for (auto fd : {promisc_fd, link_fd, prog_fd, map_fd}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    });
+
+    bpf_attr attr{};
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = static_cast<uint32_t>(queue_count);
+    map_fd = bpf(BPF_MAP_CREATE, attr);
+    if (map_fd < 0) {
+        spdlog::error("failed to create XSKMAP: {}", strerror(errno));
+        return;
+    }
+
+    const bpf_insn insns[] = {
+        // r2 = ctx->rx_queue_index
+        {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(xdp_md, rx_queue_index), 0},
+        // r1 = xskmap
+        {BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd},
+        {0, 0, 0, 0, 0},
+        // r3 = XDP_PASS, the action for queues that have no socket
+        {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS},
+        {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map},
+        {BPF_JMP | BPF_EXIT, 0, 0, 0, 0},
+    };
+    const char license[] = "MIT";
+    attr = bpf_attr{};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = reinterpret_cast<uint64_t>(insns);
+    attr.insn_cnt = sizeof(insns) / sizeof(bpf_insn);
+    attr.license = reinterpret_cast<uint64_t>(license);
+    prog_fd = bpf(BPF_PROG_LOAD, attr);
+    if (prog_fd < 0) {
+        spdlog::error("failed to load XDP program: {}", strerror(errno));
+        return;
+    }
+
+    // native mode is required for zero-copy, generic (SKB) mode works on any interface
+    for (auto native : {true, false}) {
+        if ((native && config.xdp_mode == "skb") || (!native && config.xdp_mode == "native")) {
+            continue;
+        }
+        attr = bpf_attr{};
+        attr.link_create.prog_fd = static_cast<uint32_t>(prog_fd);
+        attr.link_create.target_ifindex = static_cast<uint32_t>(ifindex);
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+        link_fd = bpf(BPF_LINK_CREATE, attr);
+        if (link_fd >= 0) {
+            native_ = native;
+            break;
+        }
+        if (native && config.xdp_mode == "auto") {
+            spdlog::warn("interface {} does not support native XDP, falling back to generic mode: {}", config.iface, strerror(errno));
+        }
+    }
+    if (link_fd < 0) {
+        spdlog::error("failed to attach XDP program to {}: {}", config.iface, strerror(errno));
+        return;
+    }
+
+    if (config.promisc) {
+        promisc_fd = socket(AF_PACKET, SOCK_RAW, 0);
+        packet_mreq mreq{};
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (promisc_fd < 0 || setsockopt(promisc_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            spdlog::error("failed to put interface {} in promiscuous mode: {}", config.iface, strerror(errno));
+            return;
+        }
+    }
+
+    std::swap(map_fd_, map_fd);
+    std::swap(prog_fd_, prog_fd);
+    std::swap(link_fd_, link_fd);
+    std::swap(promisc_fd_, promisc_fd);
+}
+
+XdpProgram::~XdpProgram() {
+    for (auto fd : {promisc_fd_, link_fd_, prog_fd_, map_fd_}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool XdpProgram::ok() const {
+    return link_fd_ >= 0;
+}
+
+bool XdpProgram::native() const {
+    return native_;
+}
+
+bool XdpProgram::add_socket(int queue, int fd) {
+    auto key = static_cast<uint32_t>(queue);
+    auto value = static_cast<uint32_t>(fd);
+    bpf_attr attr{};
+    attr.map_fd = static_cast<uint32_t>(map_fd_);
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    attr.flags = BPF_ANY;
+    if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+        spdlog::error("failed to register AF_XDP socket for queue {}: {}", queue, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static size_t xdp_frame_count(const Config& config) {
+    const auto bytes = static_cast<size_t>(config.bufsz) / static_cast<size_t>(config.capture_threads);
+    auto count = std::max<size_t>(bytes / static_cast<size_t>(config.xdp_frame_size), 64);
+    // ring sizes must be powers of two
+    while ((count & (count - 1)) != 0) {
+        count &= count - 1;
+    }
+    return count;
+}
+
+static bool map_ring(int fd, const xdp_ring_offset& off, size_t count, size_t desc_size, off_t pgoff, XdpRing& ring) {
+    ring.map_len = off.desc + (count * desc_size);
+    void* map = mmap(nullptr, ring.map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED) {
+        ring.map_len = 0;
+        return false;
+    }
+    auto base = reinterpret_cast<uint8_t*>(map);
+    ring.map = map;
+    ring.producer = reinterpret_cast<uint32_t*>(base + off.producer);
+    ring.consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+    ring.flags = reinterpret_cast<uint32_t*>(base + off.flags);
+    ring.descs = base + off.desc;
+    ring.mask = static_cast<uint32_t>(count - 1);
+    return true;
+}
+
+XdpSocket::XdpSocket(const Config& config, int ifindex, int queue, bool zero_copy, int node)
+    : queue_(queue),
+      umem_(static_cast<size_t>(config.xdp_frame_size), xdp_frame_count(config), config, node),
+      snaplen_(static_cast<uint32_t>(config.snaplen)),
+      nano_(config.nano) {
+    if (!umem_.ok()) {
+        return;
+    }
+
+    int fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (fd < 0) {
+        spdlog::error("failed to open AF_XDP socket: {}", strerror(errno));
+        return;
+    }
+    auto guard = finally([&fd] {
+        if (fd >= 0) {
+            close(fd);
+        }
+    });
+
+    xdp_umem_reg reg{};
+    reg.addr = reinterpret_cast<uint64_t>(umem_.data());
+    reg.len = umem_.size();
+    reg.chunk_size = static_cast<uint32_t>(umem_.frame_size());
+    reg.headroom = 0;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+        spdlog::error("failed to register AF_XDP frame memory: {}", strerror(errno));
+        return;
+    }
+
+    const auto count = static_cast<uint32_t>(umem_.frame_count());
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &count, sizeof(count)) < 0
+        || setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &count, sizeof(count)) < 0
+        || setsockopt(fd, SOL_XDP, XDP_RX_RING, &count, sizeof(count)) < 0) {
+        spdlog::error("failed to set up AF_XDP rings: {}", strerror(errno));
+        return;
+    }
+
+    xdp_mmap_offsets off{};
+    socklen_t off_len = sizeof(off);
+    if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0) {
+        spdlog::error("failed to query AF_XDP ring layout: {}", strerror(errno));
+        return;
+    }
+    if (!map_ring(fd, off.fr, count, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING, fill_)
+        || !map_ring(fd, off.rx, count, sizeof(xdp_desc), XDP_PGOFF_RX_RING, rx_)) {
+        spdlog::error("failed to map AF_XDP rings: {}", strerror(errno));
+        return;
+    }
+
+    // every frame starts out owned by the kernel
+    auto addrs = reinterpret_cast<uint64_t*>(fill_.descs);
+    for (uint32_t i = 0; i < count; ++i) {
+        addrs[i] = i * umem_.frame_size();
+    }
+    __atomic_store_n(fill_.producer, count, __ATOMIC_RELEASE);
+    pending_.resize(count);
+
+    sockaddr_xdp addr{};
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = static_cast<uint32_t>(ifindex);
+    addr.sxdp_queue_id = static_cast<uint32_t>(queue);
+    addr.sxdp_flags = (zero_copy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        if (zero_copy) {
+            spdlog::debug("failed to bind zero-copy AF_XDP socket to queue {}: {}", queue, strerror(errno));
+        } else {
+            spdlog::error("failed to bind AF_XDP socket to queue {}: {}", queue, strerror(errno));
+        }
+        return;
+    }
+
+    std::swap(fd_, fd);
+}
+
+XdpSocket::~XdpSocket() {
+    for (auto ring : {&rx_, &fill_}) {
+        if (ring->map != nullptr) {
+            munmap(ring->map, ring->map_len);
+            ring->map = nullptr;
+        }
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool XdpSocket::ok() const {
+    return fd_ >= 0;
+}
+
+int XdpSocket::fd() const {
+    return fd_;
+}
+
+int XdpSocket::queue() const {
+    return queue_;
+}
+
+Umem& XdpSocket::umem() {
+    return umem_;
+}
+
+int XdpSocket::poll_timeout() const {
+    // frames still held by writers must be handed back even when no traffic wakes us up
+    return pending_count_ > 0 ? 1 : -1;
+}
+
+uint64_t XdpSocket::last_timestamp() const {
+    return last_ts_.load(std::memory_order_relaxed);
+}
+
+void XdpSocket::refill() {
+    const auto size = static_cast<uint32_t>(pending_.size());
+    const auto prod = *fill_.producer;
+    const auto cons = __atomic_load_n(fill_.consumer, __ATOMIC_ACQUIRE);
+    const auto free = size - (prod - cons);
+    const auto frame_size = umem_.frame_size();
+    auto addrs = reinterpret_cast<uint64_t*>(fill_.descs);
+    uint32_t count = 0;
+    while (count < free && pending_count_ > 0) {
+        auto addr = pending_[pending_head_];
+        if (!umem_.reclaim(addr)) {
+            break;
+        }
+        addrs[(prod + count) & fill_.mask] = addr - (addr % frame_size);
+        pending_head_ = (pending_head_ + 1) & (size - 1);
+        --pending_count_;
+        ++count;
+    }
+    if (count > 0) {
+        __atomic_store_n(fill_.producer, prod + count, __ATOMIC_RELEASE);
+        if ((__atomic_load_n(fill_.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) != 0) {
+            recvfrom(fd_, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+        }
+    }
+}
+
+int XdpSocket::dispatch(Producer& producer) {
+    const auto prod = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE);
+    auto cons = *rx_.consumer;
+    const auto count = prod - cons;
+    if (count > 0) {
+        // AF_XDP carries no receive timestamp, so the whole batch gets the time it was picked up
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        const auto secs = static_cast<uint64_t>(now.tv_sec);
+        const auto nsecs = static_cast<uint64_t>(now.tv_nsec);
+        const auto frac = nano_ ? nsecs : nsecs / 1000;
+        const auto size = pending_.size();
+        auto descs = reinterpret_cast<const xdp_desc*>(rx_.descs);
+        for (; cons != prod; ++cons) {
+            const auto& desc = descs[cons & rx_.mask];
+            auto caplen = std::min(desc.len, snaplen_);
+            if (!producer.write_frame(secs, frac, desc.len, caplen, desc.addr)) {
+                umem_.release(desc.addr);
+            }
+            pending_[(pending_head_ + pending_count_) & (size - 1)] = desc.addr;
+            ++pending_count_;
+        }
+        __atomic_store_n(rx_.consumer, prod, __ATOMIC_RELEASE);
+        producer.flush();
+        rx_packets_.fetch_add(count, std::memory_order_relaxed);
+        last_ts_.store((secs * 1'000'000'000) + nsecs, std::memory_order_relaxed);
+    }
+    refill();
+    return static_cast<int>(count);
+}
+
+bool XdpSocket::stats(uint64_t& recv, uint64_t& os_drops) {
+    xdp_statistics stats{};
+    socklen_t len = sizeof(stats);
+    if (getsockopt(fd_, SOL_XDP, XDP_STATISTICS, &stats, &len) < 0) {
+        spdlog::error("failed to collect capture statistics: {}", strerror(errno));
+        return false;
+    }
+    os_drops = stats.rx_dropped + stats.rx_ring_full + stats.rx_fill_ring_empty_descs;
+    recv = rx_packets_.load(std::memory_order_relaxed) + os_drops;
+    return true;
+}